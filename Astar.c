@@ -4,285 +4,758 @@
 #include <string.h>
 #include <stdbool.h>
 #include <time.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "graph.h"
+#include "search.h"
+#include "landmarks.h"
+#include "ch.h"
+#include "matrix.h"
+#include "grid.h"
+#include "overlay.h"
 
-#define PI 3.141592
-//Earth radius (in km) for the haversine function:
-#define R_t 6371
 
+void ExitError(const char *miss, int errcode) {
+    fprintf (stderr, "\nERROR: %s.\nStopping...\n\n", miss); exit(errcode);
+}
 
-typedef struct {
-    unsigned long id;
-    //Length of node's name (this variable was not in the delivery's pdf but we will need it later on):         
-    unsigned short namelen;     
-    char* name;                 
-    double lat, lon;            
-    unsigned short nsucc;       
-    unsigned long *successors;  
-} node;
 
+unsigned long searchNode(unsigned long id, const Graph* graph)
+{
+    // the .bin file carries a hash table from id to index, built by the converter (idindex.h).
+    signed long index = idindex_find(&graph->idindex, id);
 
-typedef char Queue;
-enum whichQueue {NONE, OPEN, CLOSED};
+    // id not found, we return nnodes+1
+    if (index < 0) return graph->nnodes+1;
+    return (unsigned long)index;
+}
 
-typedef struct {
-    double g, h;                
-    unsigned long parent;       
-    Queue whq;                  
-} AStarStatus;
 
+//Function that allows us to write the final path to a txt file with some nodes' info:
+void output_txt(const Graph* graph, unsigned long* path, unsigned long length, const double* path_g, char* name) {
+    char ending[257] = "_SROutput";
+    strcat(ending, ".txt");
+    strcpy(strrchr(name, '.'), ending);
+    FILE *fout;
+    if ((fout = fopen (name, "w+")) == NULL) ExitError("the output data file cannot be created", 2);
 
-//Structure for a node in the OPEN list
-typedef struct OL_node {
-    double f;
-    unsigned long index;
-    struct OL_node* next;
-} OL_node;
+    fprintf(fout, "# Distance from %lu to %lu: %.6f meters.\n", graph->ids[path[0]], graph->ids[path[length-1]], path_g[length-1]*1000);
+    fprintf(fout, "# Optimal path:\n");
+    unsigned long i;
+    for (i = 0; i < length; i++) {
+        fprintf(fout, "Id = %lu | %.6f | %.6f | Dist = %.6f\n", graph->ids[path[i]], graph_coord(graph, path[i]).lat, graph_coord(graph, path[i]).lon, path_g[i]);
+    }
+    
+    fclose(fout);
+}
 
 
-void ExitError(const char *miss, int errcode) {
-    fprintf (stderr, "\nERROR: %s.\nStopping...\n\n", miss); exit(errcode);
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
 }
 
 
-unsigned long searchNode(unsigned long id, node *nodes, unsigned long nnodes)
-{
-    // we know that the nodes where numrically ordered by id, so we can do a binary search.
-    unsigned long l = 0, r = nnodes - 1, m;
-    while (l <= r)
-    {
-        m = l + (r - l) / 2;
-        if (nodes[m].id == id) return m;
-        if (nodes[m].id < id)
-            l = m + 1;
-        else
-            r = m - 1;
-    }
+/*Query statistics (-J and -H): a JSON line per query with the counters of SearchStats and the time
+of every phase, and a histogram of all the queries in powers of two of their total time (in
+microseconds) and of their expanded nodes. Bucket 0 holds the values below 1 and bucket k >= 1 the
+ones in [2^(k-1), 2^k).*/
+#define HIST_BUCKETS 40
 
-    // id not found, we return nnodes+1
-    return nnodes+1;
+typedef struct {
+    unsigned long queries, errors;
+    unsigned long latency[HIST_BUCKETS];
+    unsigned long expanded[HIST_BUCKETS];
+    double total_us;
+    unsigned long total_expanded;
+} Histogram;
+
+typedef struct {
+    FILE* json;                 //NULL without -J
+    Histogram* hist;            //NULL without -H
+} QueryLog;
+
+static int hist_bucket(double x) {
+    int k = 0;
+    while (x >= 1 && k < HIST_BUCKETS - 1) { x /= 2; k++; }
+    return k;
 }
 
+static void hist_merge(Histogram* to, const Histogram* from) {
+    int k;
+    to->queries += from->queries;
+    to->errors += from->errors;
+    to->total_us += from->total_us;
+    to->total_expanded += from->total_expanded;
+    for (k = 0; k < HIST_BUCKETS; k++) {
+        to->latency[k] += from->latency[k];
+        to->expanded[k] += from->expanded[k];
+    }
+}
+
+static void print_buckets(FILE* out, const char* name, const unsigned long* count) {
+    int k;
+    bool first = true;
+    fprintf(out, ", \"%s\": [", name);
+    for (k = 0; k < HIST_BUCKETS; k++) {
+        if (count[k] == 0) continue;
+        fprintf(out, "%s{\"min\": %lu, \"max\": %lu, \"queries\": %lu}", first ? "" : ", ", k ? 1UL << (k-1) : 0, 1UL << k, count[k]);
+        first = false;
+    }
+    fputc(']', out);
+}
 
-/*The following functions were built following the ones given in the delivery's pdf, the subject's notes 
-and random info from the internet.*/
+//Writes the histogram as one JSON object on a line.
+void print_histogram(FILE* out, const Histogram* h) {
+    unsigned long n = h->queries ? h->queries : 1;
+    fprintf(out, "{\"queries\": %lu, \"errors\": %lu, \"mean_us\": %.1f, \"mean_expanded\": %.1f",
+            h->queries, h->errors, h->total_us / n, (double) h->total_expanded / n);
+    print_buckets(out, "total_us", h->latency);
+    print_buckets(out, "expanded", h->expanded);
+    fprintf(out, "}\n");
+    fflush(out);
+}
 
-//Function that pops out the first element of the open list i.e. the one with least weight.
-void pop (unsigned long target, AStarStatus* PathData, OL_node* OPEN) {
-    OL_node* TEMP = OPEN;
-    OL_node* PREV = NULL;
-    while (TEMP != NULL && TEMP->index != target) {
-        PREV = TEMP;
-        TEMP = TEMP->next;
+//Records a query that took total seconds in all; error is NULL when it was answered.
+void log_query(QueryLog* log, const SearchState* S, unsigned long source, unsigned long dest, char mode,
+               const char* error, unsigned long path_len, double total) {
+    const SearchStats* st = &S->stats;
+    unsigned long expanded = S->expanded_nodes_counter + S->expanded_backward;
+    if (log->json != NULL)
+        fprintf(log->json, "{\"source\": %lu, \"dest\": %lu, \"mode\": \"%c\", \"status\": \"%s\", \"distance_m\": %.6f, "
+                "\"expanded\": %lu, \"expanded_backward\": %lu, \"relaxed\": %lu, \"decrease_keys\": %lu, \"peak_open\": %lu, "
+                "\"touched\": %lu, \"path_nodes\": %lu, \"init_us\": %.3f, \"search_us\": %.3f, \"rebuild_us\": %.3f, "
+                "\"output_us\": %.3f, \"total_us\": %.3f, \"bound\": %.6f}\n",
+                source, dest, mode, (error != NULL) ? error : "ok", (error != NULL) ? -1 : S->distance*1000,
+                S->expanded_nodes_counter, S->expanded_backward, st->relaxed, st->decreased, st->peak_open,
+                st->touched, path_len, st->init_time*1e6, st->search_time*1e6, st->rebuild_time*1e6,
+                st->output_time*1e6, total*1e6, S->bound);
+    if (log->hist != NULL) {
+        log->hist->queries += 1;
+        if (error != NULL) log->hist->errors += 1;
+        log->hist->total_us += total*1e6;
+        log->hist->total_expanded += expanded;
+        log->hist->latency[hist_bucket(total*1e6)] += 1;
+        log->hist->expanded[hist_bucket(expanded)] += 1;
     }
-    PREV->next = TEMP->next;
-    free(TEMP);
 }
 
-//Function that pushes a node into the open list taking into account its weight!
-void push (unsigned long index, AStarStatus* PathData, OL_node* OPEN, node* nodes, unsigned long src_index, unsigned long dest_index) {
-    (PathData + index)->whq = 1;
-    OL_node* TEMP = OPEN;                                                                 
-    OL_node* new_node = NULL;                                                             
-    if ((new_node = (OL_node*) malloc(sizeof(OL_node))) == NULL) ExitError("when allocating memory for a new node in the OPEN list", 1);
-    new_node->index = index;                                                                
-    new_node->f = PathData[index].g + PathData[index].h;
-    new_node->next = NULL;                                                                  
-    while ( (TEMP->next != NULL) && ((TEMP->next)->f <= new_node->f ) ) TEMP = TEMP->next;  
-    if (TEMP->next == NULL) TEMP->next = new_node;                                          
-    else if ((TEMP->next)->f > new_node->f) {                                               
-        new_node->next = TEMP->next;
-        TEMP->next = new_node;
+
+//What a query can be routed on: the graph and the optional preprocessed data next to it.
+typedef struct {
+    const Graph* graph;
+    const Landmarks* alt;       //NULL without a .alt file
+    const CHGraph* ch;          //NULL without a .ch file
+    Overlay* updates;           //Update log followed over the graph (overlay.h)
+} Router;
+
+/*The router of one query: the latest snapshot of the update log, which is held in *snap until
+overlay_release(), with the landmarks as long as no edge got shorter and the hierarchy only while
+there are no updates.*/
+Router router_snapshot(const Router* router, OverlaySnapshot** snap) {
+    *snap = overlay_acquire(router->updates);
+    Router r = {&(*snap)->graph, (*snap)->shorter ? NULL : router->alt, ((*snap)->nupdates > 0) ? NULL : router->ch, router->updates};
+    return r;
+}
+
+/*Search algorithm of a query: 'a' for A* (the default), 'b' for bidirectional A*, 'l' for A* with
+landmarks, 'c' for the contraction hierarchy, and 'w' for weighted A* and 'r' for anytime A* within
+limits. Returns false if there is no path.*/
+bool run_search(const Router* router, SearchState* S, char mode, const SuboptimalLimits* limits, unsigned long source_index, unsigned long dest_index) {
+    if (mode == 'w') return WeightedAStar(router->graph, S, source_index, dest_index, limits->epsilon);
+    if (mode == 'r') return AnytimeAStar(router->graph, S, source_index, dest_index, limits);
+    if (mode == 'b') return BiAStar(router->graph, S, source_index, dest_index);
+    if (mode == 'l') return AStarALT(router->graph, router->alt, S, source_index, dest_index);
+    if (mode == 'c') return CHSearch(router->ch, S, source_index, dest_index);
+    return AStar(router->graph, S, source_index, dest_index);
+}
+
+/*An end of a query: an OSM node id, or a coordinate "lat,lon" that is snapped to its nearest routable
+node (see grid.h). Stores the id of the node and returns false if the text is neither.*/
+bool parse_endpoint(const Graph* graph, const char* text, unsigned long* id) {
+    char* end;
+    if (strchr(text, ',') == NULL) {
+        *id = strtoul(text, &end, 10);
+        return end != text && *end == '\0';
     }
+    double lat, lon;
+    char extra;
+    if (sscanf(text, "%lf,%lf%c", &lat, &lon, &extra) != 2 || fabs(lat) > 90 || fabs(lon) > 180) return false;
+    unsigned long index = grid_snap(graph, lat, lon, true, NULL);
+    if (index >= graph->nnodes) return false;
+    *id = graph->ids[index];
+    return true;
 }
 
-//We have chosen the havershine distance to be our heuristic function:
-double haversine (node u, node v) {
-    double diff_lat = (u.lat - v.lat) * PI / 180.f;
-    double diff_lon = (u.lon - v.lon) * PI / 180.f;
-    double a = pow(sin(diff_lat/2), 2) + cos(u.lat * PI / 180.f) * cos(v.lat * PI / 180.f) * pow(sin(diff_lon/2), 2);
-    double c = 2 * atan2(sqrt(a), sqrt(1-a));
-    double d = R_t * c;
-    return d;
+/*Parses a query line "source dest [mode [epsilon [milliseconds [expansions]]]]", where source and
+dest are node ids or coordinates (parse_endpoint()) and the limits only go with the modes w
+(epsilon) and r (all three). Returns false if it is malformed, has anything after its last field,
+or a limit that is negative or not finite.*/
+#define DEFAULT_EPSILON             0.1
+#define DEFAULT_ANYTIME_EPSILON     1.0
+#define DEFAULT_ANYTIME_MS          10
+
+bool parse_query(const Graph* graph, const char* line, unsigned long* source, unsigned long* dest, char* mode, SuboptimalLimits* limits) {
+    char from[64], to[64], m[64] = "a";
+    double epsilon = -1, ms = DEFAULT_ANYTIME_MS;
+    unsigned long expansions = 0;
+    //end[k] is where field k+2 ends, so that what follows the last field read can be checked.
+    int end[4] = {0, 0, 0, 0}, n0 = 0;
+    int n = sscanf(line, "%63s %63s%n %63s%n %lf%n %lf%n %lu%n", from, to, &n0, m, &end[0], &epsilon, &end[1], &ms, &end[2], &expansions, &end[3]);
+    if (n < 2) return false;
+    const char* rest = line + ((n == 2) ? n0 : end[n-3]);
+    while (*rest == ' ' || *rest == '\t' || *rest == '\r' || *rest == '\n') rest++;
+    if (*rest != '\0' || strlen(m) != 1) return false;
+    if (!parse_endpoint(graph, from, source) || !parse_endpoint(graph, to, dest)) return false;
+    *mode = m[0];
+    limits->epsilon = (n >= 4) ? epsilon : (*mode == 'r') ? DEFAULT_ANYTIME_EPSILON : DEFAULT_EPSILON;
+    limits->time_limit = ms / 1000;
+    limits->max_expanded = expansions;
+    if (n < 2 || strchr("ablcwr", *mode) == NULL) return false;
+    if (n >= 4 && (*mode != 'w' && *mode != 'r')) return false;
+    if (n >= 5 && *mode != 'r') return false;
+    return limits->epsilon >= 0 && isfinite(limits->epsilon) && ms >= 0 && isfinite(ms);
 }
 
+/*Answers one query with a single line, "OK source dest meters expanded_fwd expanded_bwd length ids..."
+(followed by "bound b" for the modes w and r) or "ERROR source dest reason", and records it in log
+(NULL for no statistics).*/
+void answer_query(const Router* router, SearchState* S, unsigned long source, unsigned long dest, char mode, const SuboptimalLimits* limits,
+                  FILE* out, QueryLog* log) {
+    OverlaySnapshot* snap;
+    Router current = router_snapshot(router, &snap);
+    const Graph* graph = current.graph;
+    double t0 = (log != NULL) ? now() : 0;
+    S->timed = (log != NULL);
+    memset(&S->stats, 0, sizeof(SearchStats));
+    S->expanded_nodes_counter = S->expanded_backward = 0;
+    S->bound = 1;
+    const char* error = NULL;
+    unsigned long i, path_len = 0;
+    unsigned long source_index = searchNode(source, graph);
+    unsigned long dest_index   = searchNode(dest, graph);
+    if (source_index >= graph->nnodes || dest_index >= graph->nnodes) error = "unknown node";
+    else if (mode == 'l' && current.alt == NULL) error = (router->alt != NULL) ? "landmarks outdated by updates" : "no landmarks";
+    else if (mode == 'c' && current.ch == NULL) error = (router->ch != NULL) ? "hierarchy outdated by updates" : "no hierarchy";
+    else if (!run_search(&current, S, mode, limits, source_index, dest_index)) error = "no path";
+    if (error != NULL) fprintf(out, "ERROR %lu %lu %s\n", source, dest, error);
+    else {
+        path_len = rebuild_path(S, source_index, dest_index);
+        double t1 = (log != NULL) ? now() : 0;
+        fprintf(out, "OK %lu %lu %.6f %lu %lu %lu", source, dest, S->distance*1000, S->expanded_nodes_counter, S->expanded_backward, path_len);
+        for (i = 0; i < path_len; i++) fprintf(out, " %lu", graph->ids[S->path[i]]);
+        if (mode == 'w' || mode == 'r') fprintf(out, " bound %.6f", S->bound);
+        fputc('\n', out);
+        if (log != NULL) S->stats.output_time = now() - t1;
+    }
+    if (log != NULL) log_query(log, S, source, dest, mode, error, path_len, now() - t0);
+    overlay_release(router->updates, snap);
+}
 
-//Function that allows us to write the final path to a txt file with some nodes' info:
-void output_txt(node* nodes, unsigned long* path, unsigned long length, AStarStatus* info, char* name) {
-    char ending[257] = "_SROutput";
-    char buffer[11];
-    strcat(ending, ".txt");
-    strcpy(strrchr(name, '.'), ending);
-    FILE *fout;
-    if ((fout = fopen (name, "w+")) == NULL) ExitError("the output data file cannot be created", 2);
+/*Query-server loop: reads "source_id dest_id [mode]" lines until the end of the input and streams one
+reply per query. Empty lines and lines starting with '#' are skipped.*/
+void serve(const Router* router, SearchState* S, FILE* in, FILE* out, QueryLog* log) {
+    char* line = NULL;
+    size_t line_cap = 0;
+    unsigned long source, dest;
+    char mode;
+    SuboptimalLimits limits;
+    while (getline(&line, &line_cap, in) >= 0) {
+        if (*line == '#' || *line == '\n') continue;
+        //The coordinates are snapped on the latest graph, whose routable nodes the updates may have changed.
+        OverlaySnapshot* snap;
+        Router current = router_snapshot(router, &snap);
+        bool valid = parse_query(current.graph, line, &source, &dest, &mode, &limits);
+        overlay_release(router->updates, snap);
+        if (!valid) fprintf(out, "ERROR 0 0 bad query\n");
+        else answer_query(router, S, source, dest, mode, &limits, out, log);
+        fflush(out);
+        if (log != NULL && log->json != NULL) fflush(log->json);
+    }
+    free(line);
+}
 
-    fprintf(fout, "# Distance from %lu to %lu: %.6f meters.\n", nodes[path[0]].id, nodes[path[length-1]].id, info[path[length-1]].g*1000);
-    fprintf(fout, "# Optimal path:\n");
-    unsigned long i;
-    for (i = 0; i < length; i++) {
-        fprintf(fout, "Id = %lu | %.6f | %.6f | Dist = %.6f\n", nodes[path[i]].id, nodes[path[i]].lat, nodes[path[i]].lon, info[path[i]].g);
+/*Serves the clients of a Unix socket, one connection after another, until the process is killed.
+With a histogram, the one of all the queries so far is written to stderr after every client.*/
+void serve_socket(const Router* router, SearchState* S, const char* sockpath, QueryLog* log) {
+    int lfd, cfd;
+    struct sockaddr_un addr;
+    if (strlen(sockpath) >= sizeof(addr.sun_path)) ExitError("the socket path is too long", 16);
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, sockpath);
+    unlink(sockpath);
+    if ((lfd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0 || bind(lfd, (struct sockaddr*)&addr, sizeof(addr)) < 0 || listen(lfd, 16) < 0)
+        ExitError("when creating the query socket", 16);
+    signal(SIGPIPE, SIG_IGN);
+    while ((cfd = accept(lfd, NULL, NULL)) >= 0) {
+        FILE* in = fdopen(cfd, "r");
+        FILE* out = fdopen(dup(cfd), "w");
+        if (in == NULL || out == NULL) ExitError("when opening a client connection", 17);
+        serve(router, S, in, out, log);
+        fclose(in);
+        fclose(out);
+        if (log != NULL && log->hist != NULL) print_histogram(stderr, log->hist);
     }
-    
-    fclose(fout);
+    ExitError("when accepting a client connection", 17);
 }
 
 
-//A* algorithm as a function:
-void AStar (node* nodes, unsigned long source, unsigned long dest, unsigned long nnodes, char* name) {
-    
-    unsigned long source_index = (unsigned long)searchNode(source, nodes, nnodes);           
-    unsigned long dest_index   = (unsigned long)searchNode(dest, nodes, nnodes);            
 
-    AStarStatus* PathData = NULL;
-    if ((PathData = (AStarStatus*) malloc(nnodes*sizeof(AStarStatus))) == NULL) ExitError("when allocating memory for the PathData vector", 3);
-    unsigned long i;
-    for (i = 0; i < nnodes; i++) {
-        PathData[i].whq = 0;                                                                  
-        PathData[i].g = INFINITY;                                                             
+/*Batch routing: the queries of a file are spread over worker threads, each one with its own
+SearchState on the shared graph. Every worker starts with a contiguous range of queries and, when
+its range runs out, steals the back half of the largest range left. The replies are kept per query
+and written in input order as soon as the next one is ready, and so are their JSON statistics. Each
+worker fills its own histogram and they are added up at the end.*/
+typedef struct {
+    unsigned long source, dest;
+    char mode;
+    SuboptimalLimits limits;
+    bool valid;
+    bool done;                  //Protected by the output lock
+    char* reply;
+    size_t reply_len;
+    char* stats;                //JSON line with -J
+    size_t stats_len;
+} BatchQuery;
+
+typedef struct {
+    pthread_mutex_t lock;
+    unsigned long lo, hi;       //Queries left in the range
+} WorkRange;
+
+typedef struct {
+    const Router* router;
+    BatchQuery* queries;
+    unsigned long nqueries;
+    WorkRange* ranges;
+    int nworkers;
+    const QueryLog* log;        //NULL without statistics
+    pthread_mutex_t out_lock;
+    pthread_cond_t out_ready;
+} Batch;
+
+typedef struct {
+    Batch* batch;
+    int id;
+    Histogram hist;
+} BatchWorker;
+
+
+//Gets the next query of a worker, stealing from the largest range when its own range is empty.
+static bool take_query(Batch* b, int w, unsigned long* q) {
+    WorkRange* own = &b->ranges[w];
+    pthread_mutex_lock(&own->lock);
+    if (own->lo < own->hi) {
+        *q = own->lo++;
+        pthread_mutex_unlock(&own->lock);
+        return true;
     }
-    PathData[source_index].whq = 1;                                                           
-    PathData[source_index].g = 0;                                                             
-    PathData[source_index].h = haversine( nodes[source_index], nodes[dest_index]);            
-
-    struct OL_node* OPEN = NULL;                                                         
-    if ((OPEN = (OL_node*) malloc(sizeof(OL_node))) == NULL) ExitError("when allocating memory for the OPEN list", 4);
-    struct OL_node* AUX = NULL;
-    OPEN->index = source_index;
-    OPEN->f = PathData[source_index].g + PathData[source_index].h;
-    OPEN->next = NULL;
-    unsigned long cur_index;                    
-    unsigned short succ_count;                  
-    unsigned long succ_index;                   
-    double successor_current_cost;              
-    double w;                                   
-    unsigned long expanded_nodes_counter = 0;   
-    clock_t start, end;                         
-    double cpu_time_used;
-    start = clock();                            
-    while (OPEN != NULL) {
-        cur_index = OPEN->index;
-        expanded_nodes_counter += 1;
-        if (cur_index == dest_index) {                                              
-            printf("DESTINATION REACHED! Check SROutput.txt file.\n");
-            break;
+    pthread_mutex_unlock(&own->lock);
+    while (true) {
+        int v, victim = -1;
+        unsigned long left, most = 0;
+        for (v = 0; v < b->nworkers; v++) {
+            pthread_mutex_lock(&b->ranges[v].lock);
+            left = b->ranges[v].hi - b->ranges[v].lo;
+            pthread_mutex_unlock(&b->ranges[v].lock);
+            if (left > most) { most = left; victim = v; }
         }
-        for (succ_count = 0; succ_count < nodes[cur_index].nsucc; succ_count++) {   
-            succ_index = (nodes[cur_index].successors)[succ_count];                 
-            w = haversine( nodes[cur_index], nodes[succ_index] );                   
-            successor_current_cost = PathData[cur_index].g + w;                    
-            if ( PathData[succ_index].whq == 1 ) {
-                if ( PathData[succ_index].g <= successor_current_cost ) continue;   
-                else pop(succ_index, PathData, OPEN);                  
-            }
-            else if ( PathData[succ_index].whq == 2 ) continue;
-            else PathData[succ_index].h = haversine( nodes[succ_index], nodes[dest_index] ); 
-            
-            PathData[succ_index].g = successor_current_cost;                       
-            PathData[succ_index].parent = cur_index;                                
-            push(succ_index, PathData, OPEN, nodes, source_index, dest_index);
+        if (victim < 0) return false;
+        WorkRange* r = &b->ranges[victim];
+        pthread_mutex_lock(&r->lock);
+        left = r->hi - r->lo;
+        if (left == 0) {                        //Somebody was faster, look again
+            pthread_mutex_unlock(&r->lock);
+            continue;
         }
-        PathData[cur_index].whq = 2;                                               
-        AUX = OPEN->next;   free(OPEN);     OPEN = AUX;                                                                                                                      
+        unsigned long hi = r->hi;
+        r->hi -= (left + 1) / 2;
+        unsigned long lo = r->hi;
+        pthread_mutex_unlock(&r->lock);
+        pthread_mutex_lock(&own->lock);
+        own->lo = lo + 1;
+        own->hi = hi;
+        pthread_mutex_unlock(&own->lock);
+        *q = lo;
+        return true;
     }
-    end = clock();                                                                      
-    if (OPEN == NULL) ExitError("OPEN list is empty before reaching destination", 5);  
+}
 
-    while (OPEN != NULL) {                                                              
-        AUX = OPEN->next;   free(OPEN);     OPEN = AUX;
+static void* batch_worker(void* arg) {
+    Batch* b = ((BatchWorker*) arg)->batch;
+    int w = ((BatchWorker*) arg)->id;
+    QueryLog log = {NULL, (b->log != NULL && b->log->hist != NULL) ? &((BatchWorker*) arg)->hist : NULL};
+    SearchState S;
+    search_init(&S, b->router->graph->nnodes);
+    unsigned long q;
+    while (take_query(b, w, &q)) {
+        BatchQuery* query = &b->queries[q];
+        FILE* out = open_memstream(&query->reply, &query->reply_len);
+        if (out == NULL) ExitError("when allocating memory for a reply", 18);
+        if (b->log != NULL && b->log->json != NULL &&
+            (log.json = open_memstream(&query->stats, &query->stats_len)) == NULL) ExitError("when allocating memory for a reply", 18);
+        if (!query->valid) fprintf(out, "ERROR 0 0 bad query\n");
+        else answer_query(b->router, &S, query->source, query->dest, query->mode, &query->limits, out, (b->log != NULL) ? &log : NULL);
+        fclose(out);
+        if (log.json != NULL) fclose(log.json);
+        pthread_mutex_lock(&b->out_lock);
+        query->done = true;
+        pthread_cond_signal(&b->out_ready);
+        pthread_mutex_unlock(&b->out_lock);
     }
-    cpu_time_used = ((double) (end - start)) / CLOCKS_PER_SEC;                          
-    printf("Optimal distance: %.6f meters.\n", PathData[dest_index].g*1000);
-    printf("A* time elapsed: %.6f seconds.\n", cpu_time_used);
-
-    cur_index = dest_index;
-    unsigned long path_len = 0;
-    while (cur_index != source_index) {
-        path_len += 1;
-        cur_index = PathData[cur_index].parent;
+    search_free(&S);
+    return NULL;
+}
+
+//Routes all the queries of a file with nworkers threads and writes the replies to out, in input order.
+void route_batch(const Router* router, const char* queryfile, int nworkers, FILE* out, QueryLog* log) {
+    FILE* in;
+    if ((in = fopen(queryfile, "r")) == NULL) ExitError("the query file cannot be opened", 19);
+    Batch b;
+    memset(&b, 0, sizeof(Batch));
+    b.router = router;
+    b.log = log;
+    unsigned long cap = 0;
+    char* line = NULL;
+    size_t line_cap = 0;
+    OverlaySnapshot* snap;
+    Router current = router_snapshot(router, &snap);
+    while (getline(&line, &line_cap, in) >= 0) {
+        if (*line == '#' || *line == '\n') continue;
+        if (b.nqueries == cap) {
+            cap = cap ? 2*cap : 1024;
+            if ((b.queries = (BatchQuery*) realloc(b.queries, cap*sizeof(BatchQuery))) == NULL) ExitError("when allocating memory for the queries", 18);
+        }
+        BatchQuery* query = &b.queries[b.nqueries++];
+        memset(query, 0, sizeof(BatchQuery));
+        query->valid = parse_query(current.graph, line, &query->source, &query->dest, &query->mode, &query->limits);
     }
-    path_len += 1;
-
-    unsigned long* path = NULL;
-    if ((path = (unsigned long*) malloc(path_len*sizeof(unsigned long))) == NULL) ExitError("when allocating memory for the path vector", 6);
-    path += path_len - 1;
-    cur_index = dest_index;
-    while (cur_index != source_index) { 
-        *path = cur_index;
-        cur_index = PathData[cur_index].parent;
-        path -= 1;
+    overlay_release(router->updates, snap);
+    free(line);
+    fclose(in);
+
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    if (nworkers < 1) nworkers = 1;
+    b.nworkers = nworkers;
+    pthread_mutex_init(&b.out_lock, NULL);
+    pthread_cond_init(&b.out_ready, NULL);
+    BatchWorker workers[nworkers];
+    pthread_t threads[nworkers];
+    WorkRange ranges[nworkers];
+    b.ranges = ranges;
+    int w;
+    for (w = 0; w < nworkers; w++) {
+        pthread_mutex_init(&ranges[w].lock, NULL);
+        ranges[w].lo = b.nqueries * w / nworkers;
+        ranges[w].hi = b.nqueries * (w + 1) / nworkers;
+        workers[w].batch = &b;
+        workers[w].id = w;
+        memset(&workers[w].hist, 0, sizeof(Histogram));
     }
-    if (cur_index == source_index) *path = cur_index;
-    
-    output_txt(nodes, path, path_len, PathData, name);
-    
-    free(path);
-    free(PathData);
+    for (w = 0; w < nworkers; w++)
+        if (pthread_create(&threads[w], NULL, batch_worker, &workers[w]) != 0) ExitError("when creating a worker thread", 20);
+
+    unsigned long next;
+    pthread_mutex_lock(&b.out_lock);
+    for (next = 0; next < b.nqueries; next++) {
+        while (!b.queries[next].done) pthread_cond_wait(&b.out_ready, &b.out_lock);
+        pthread_mutex_unlock(&b.out_lock);
+        fwrite(b.queries[next].reply, 1, b.queries[next].reply_len, out);
+        free(b.queries[next].reply);
+        if (b.queries[next].stats != NULL) {
+            fwrite(b.queries[next].stats, 1, b.queries[next].stats_len, log->json);
+            free(b.queries[next].stats);
+        }
+        pthread_mutex_lock(&b.out_lock);
+    }
+    pthread_mutex_unlock(&b.out_lock);
+    for (w = 0; w < nworkers; w++) pthread_join(threads[w], NULL);
+    fflush(out);
+    if (log != NULL && log->hist != NULL)
+        for (w = 0; w < nworkers; w++) hist_merge(log->hist, &workers[w].hist);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+
+    double elapsed = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) * 1e-9;
+    fprintf(stderr, "Routed %lu queries in %.3f seconds (%.1f queries/s, %d threads).\n", b.nqueries, elapsed, b.nqueries / elapsed, nworkers);
+    for (w = 0; w < nworkers; w++) pthread_mutex_destroy(&ranges[w].lock);
+    pthread_mutex_destroy(&b.out_lock);
+    pthread_cond_destroy(&b.out_ready);
+    free(b.queries);
 }
 
 
 
-int main (int argc, char *argv[]) {
-    
-    FILE *fin;
-    if ((fin = fopen (argv[1], "rb")) == NULL)
-        ExitError("Please pass a binary file as an argument", 7);
-       
-    unsigned long nnodes;
-    unsigned long nsucc;
-    unsigned long totnamelen;
-    if( fread(&nnodes, sizeof(unsigned long), 1, fin) +
-        fread(&nsucc, sizeof(unsigned long), 1, fin)
-         + fread(&totnamelen, sizeof(unsigned long), 1, fin) != 3 )
-            ExitError("when reading the header of the binary data file", 8);
-    
-    node* nodes;
-    if ((nodes = (node*) malloc(nnodes*sizeof(node))) == NULL)
-        ExitError("when allocating memory for the nodes vector", 9);
-    
-    unsigned long* allsuccessors;
-    if ((allsuccessors = (unsigned long*) malloc(nsucc*sizeof(unsigned long))) == NULL)
-        ExitError("when allocating memory for the edges vector", 10);
-    
-    char* allnames = NULL;
-    if((allnames = (char*) malloc((totnamelen)*sizeof(char))) == NULL) ExitError("when allocating memory for allnames vector", 11);
-    char* allnames_aux = allnames; 
-    
-    if( fread(nodes, sizeof(node), nnodes, fin) != nnodes )
-        ExitError("when reading nodes from the binary data file", 12);
-    
-    if( fread(allsuccessors, sizeof(unsigned long), nsucc, fin) != nsucc)
-        ExitError("when reading sucessors from the binary data file", 13);
+//Reads a file of node ids, one per line (empty lines and lines starting with '#' are skipped).
+NodeIndex* read_nodes(const char* file, const Graph* graph, unsigned long* n) {
+    FILE* in;
+    if ((in = fopen(file, "r")) == NULL) ExitError("the node list of the matrix cannot be opened", 19);
+    NodeIndex* nodes = NULL;
+    unsigned long cap = 0, index;
+    char* line = NULL;
+    size_t line_cap = 0;
+    *n = 0;
+    while (getline(&line, &line_cap, in) >= 0) {
+        if (*line == '#' || *line == '\n') continue;
+        if ((index = searchNode(strtoul(line, NULL, 10), graph)) >= graph->nnodes) {
+            fprintf(stderr, "Unknown node in %s: %s", file, line);
+            ExitError("a node of the matrix is not in the graph", 9);
+        }
+        if (*n == cap) {
+            cap = cap ? 2*cap : 1024;
+            if ((nodes = (NodeIndex*) realloc(nodes, cap*sizeof(NodeIndex))) == NULL) ExitError("when allocating memory for the node list", 18);
+        }
+        nodes[(*n)++] = (NodeIndex)index;
+    }
+    free(line);
+    fclose(in);
+    return nodes;
+}
 
-    if( fread(allnames, sizeof(char), totnamelen, fin) != totnamelen)
-        ExitError("when reading names from the binary data file", 14);
-    
-    fclose(fin);
-    
-//We store all names and all successors of all nodes in two respective vectors as recommended in the pdf:
-    unsigned long i;
-    for (i = 0; i < nnodes; i++) {
-        if(nodes[i].nsucc) {
-            nodes[i].successors = allsuccessors;
-            allsuccessors += nodes[i].nsucc;
+/*Distance matrix from the nodes of sourcefile to the ones of targetfile, written to outfile (stdout
+if NULL) as csv, or in binary if its name ends in ".bin". With pathfile the paths are written too.*/
+void route_matrix(const Router* router, const char* sourcefile, const char* targetfile, const char* outfile, const char* pathfile, int nworkers) {
+    unsigned long nsources, ntargets;
+    NodeIndex* sources = read_nodes(sourcefile, router->graph, &nsources);
+    NodeIndex* targets = read_nodes(targetfile, router->graph, &ntargets);
+    FILE *out = stdout, *paths = NULL;
+    if (outfile != NULL && (out = fopen(outfile, "wb")) == NULL) ExitError("the matrix file cannot be created", 2);
+    if (pathfile != NULL && (paths = fopen(pathfile, "w")) == NULL) ExitError("the path file cannot be created", 2);
+    if (nworkers < 1) nworkers = 1;
+
+    OverlaySnapshot* snap;
+    Router current = router_snapshot(router, &snap);
+    double t0 = now();
+    double* m = distance_matrix(current.graph, current.ch, sources, nsources, targets, ntargets, nworkers, paths);
+    double elapsed = now() - t0;
+    overlay_release(router->updates, snap);
+    const char* dot = (outfile != NULL) ? strrchr(outfile, '.') : NULL;
+    if (dot != NULL && strcmp(dot, ".bin") == 0) write_matrix_bin(out, router->graph, m, sources, nsources, targets, ntargets);
+    else write_matrix_csv(out, router->graph, m, sources, nsources, targets, ntargets);
+    fprintf(stderr, "Computed a %lu x %lu matrix in %.3f seconds (%s, %d threads).\n", nsources, ntargets, elapsed,
+            (current.ch != NULL && paths == NULL) ? "hierarchy buckets" : "one search per source", nworkers);
+
+    if (out != stdout && fclose(out) != 0) ExitError("when closing the matrix file", 2);
+    if (paths != NULL && fclose(paths) != 0) ExitError("when closing the path file", 2);
+    free(m);
+    free(sources);
+    free(targets);
+}
+
+/*Snaps the points of pointfile, one "lat lon" or "lat,lon" per line, to their nearest nodes (routable
+ones with routable) and writes "lat lon node_id meters" per point to stdout, with an empty node_id
+and meters if there is none.*/
+void snap_points(const Graph* graph, const char* pointfile, bool routable) {
+    FILE* in = (strcmp(pointfile, "-") == 0) ? stdin : fopen(pointfile, "r");
+    if (in == NULL) ExitError("the point file cannot be opened", 2);
+    Coord* points = NULL;
+    unsigned long n = 0, cap = 0, i;
+    char* line = NULL;
+    size_t line_cap = 0;
+    while (getline(&line, &line_cap, in) >= 0) {
+        if (*line == '#' || *line == '\n') continue;
+        Coord c;
+        if (sscanf(line, "%lf%*[ ,\t]%lf", &c.lat, &c.lon) != 2 || fabs(c.lat) > 90 || fabs(c.lon) > 180) {
+            fprintf(stderr, "Invalid point in %s: %s", pointfile, line);
+            ExitError("a point is not a valid lat lon pair", 9);
         }
-        if ((nodes[i].name = (char*) malloc(nodes[i].namelen + 1)) == NULL) ExitError("when allocating memory for a node name", 15);
-        strncpy(nodes[i].name, allnames, nodes[i].namelen);
-        memset(nodes[i].name + nodes[i].namelen, '\0', 1);
-        allnames += nodes[i].namelen;
-        
+        if (n == cap) {
+            cap = cap ? 2*cap : 1024;
+            if ((points = (Coord*) realloc(points, cap*sizeof(Coord))) == NULL) ExitError("when allocating memory for the points", 18);
+        }
+        points[n++] = c;
     }
-    free(allnames_aux);
-    
-    unsigned long source = 240949599;             //SOURCE NODE'S ID
-    unsigned long dest = 195977239;               //DESTINATION NODE'S ID
-    
-    
-    AStar(nodes, source, dest, nnodes, argv[1]);
+    free(line);
+    if (in != stdin) fclose(in);
+
+    unsigned long* nodes;
+    double* km;
+    if ((nodes = (unsigned long*) malloc((n ? n : 1)*sizeof(unsigned long))) == NULL ||
+        (km = (double*) malloc((n ? n : 1)*sizeof(double))) == NULL) ExitError("when allocating memory for the points", 18);
+    double t0 = now();
+    grid_snap_batch(graph, points, n, routable, nodes, km);
+    double elapsed = now() - t0;
+    for (i = 0; i < n; i++) {
+        if (nodes[i] < graph->nnodes) printf("%.7f %.7f %lu %.3f\n", points[i].lat, points[i].lon, graph->ids[nodes[i]], km[i]*1000);
+        else printf("%.7f %.7f\n", points[i].lat, points[i].lon);
+    }
+    fprintf(stderr, "Snapped %lu points to their nearest %snodes in %.3f seconds (%.3f us per point).\n", n,
+            routable ? "routable " : "", elapsed, n ? elapsed / n * 1e6 : 0);
+    free(points);
+    free(nodes);
+    free(km);
+}
+
+
+
+int main (int argc, char *argv[]) {
     
+    /*astar map.bin [source_id dest_id [a|b|l|c|w|r ...]]   one query, written to map_SROutput.txt
+      astar -s map.bin                    query server: pairs from stdin, replies to stdout
+      astar -u socket map.bin             query server on a Unix socket
+      astar -b queries [-j threads] map.bin   batch of queries routed in parallel, replies to stdout
+      astar -M sources [-T targets] [-o matrix.csv|.bin] [-P paths] [-j threads] map.bin   distance matrix
+      astar -N points map.bin             nearest routable node of every point ('-' for stdin), -n for any node
+      A source or dest can be a node id or a coordinate "lat,lon", snapped to its nearest routable node.
+      The routes follow the update log map.upd (-U file for another one), also while serving.
+      Any of them also takes -J file, a JSON line of statistics per query ('-' for stderr), and -H, a
+      histogram of all the queries written to stderr at the end.*/
+    bool server = false;
+    char* sockpath = NULL;
+    char* queryfile = NULL;
+    char* jsonfile = NULL;
+    char *sourcefile = NULL, *targetfile = NULL, *matrixfile = NULL, *pathfile = NULL;
+    char* pointfile = NULL;
+    char* updatefile = NULL;
+    bool histogram = false, any_node = false;
+    int nworkers = (int) sysconf(_SC_NPROCESSORS_ONLN);
+    int opt;
+    while ((opt = getopt(argc, argv, "su:b:j:J:HM:T:o:P:N:n:U:")) != -1) {
+        if (opt == 's') server = true;
+        else if (opt == 'u') sockpath = optarg;
+        else if (opt == 'b') queryfile = optarg;
+        else if (opt == 'j') nworkers = atoi(optarg);
+        else if (opt == 'J') jsonfile = optarg;
+        else if (opt == 'H') histogram = true;
+        else if (opt == 'M') sourcefile = optarg;
+        else if (opt == 'T') targetfile = optarg;
+        else if (opt == 'o') matrixfile = optarg;
+        else if (opt == 'P') pathfile = optarg;
+        else if (opt == 'N' || opt == 'n') { pointfile = optarg; any_node = (opt == 'n'); }
+        else if (opt == 'U') updatefile = optarg;
+        else ExitError("usage: astar [-s | -u socket | -b queries [-j threads] | -M sources [-T targets] [-o matrix] [-P paths] [-j threads] | -N|-n points] "
+                       "[-U updates] [-J stats.json] [-H] map.bin [source_id dest_id [a|b|l|c|w|r ...]]", 1);
+    }
+    if (optind >= argc) ExitError("Please pass a binary file as an argument", 7);
+    char* binfile = argv[optind];
+
+    //The .bin file is mapped and used in place: no per node copies or allocations are needed.
+    Graph graph;
+    const char* err;
+    if ((err = graph_open(&graph, binfile)) != NULL) ExitError(err, 8);
+    Router router = {&graph, NULL, NULL, NULL};
+    Overlay updates;
+    char sidefile[4096];
+    if (updatefile == NULL) graph_sidecar_path(binfile, ".upd", sidefile, sizeof(sidefile));
+    overlay_open(&updates, &graph, (updatefile != NULL) ? updatefile : sidefile);
+    router.updates = &updates;
+
+    if (pointfile != NULL) {
+        //Snapped on the graph with its updates, whose routable nodes may not be the ones of the file.
+        OverlaySnapshot* snap;
+        Router current = router_snapshot(&router, &snap);
+        snap_points(current.graph, pointfile, !any_node);
+        overlay_release(&updates, snap);
+        overlay_close(&updates);
+        graph_close(&graph);
+        return 0;
+    }
 
-    for (i = 0; i < nnodes; i++) free(nodes[i].name);
-    free(nodes);
-    allsuccessors -= nsucc;     
-    free(allsuccessors);
+    //The landmarks of write_alt and the hierarchy of write_ch, if they are there. A stale file is reported and left unused.
+    Landmarks alt;
+    CHGraph ch;
+    graph_sidecar_path(binfile, ".alt", sidefile, sizeof(sidefile));
+    if (access(sidefile, F_OK) == 0) {
+        if ((err = landmarks_open(&alt, sidefile, &graph)) != NULL) fprintf(stderr, "Ignoring %s: %s.\n", sidefile, err);
+        else router.alt = &alt;
+    }
+    graph_sidecar_path(binfile, ".ch", sidefile, sizeof(sidefile));
+    if (access(sidefile, F_OK) == 0) {
+        if ((err = ch_open(&ch, sidefile, &graph)) != NULL) fprintf(stderr, "Ignoring %s: %s.\n", sidefile, err);
+        else router.ch = &ch;
+    }
+    if (sourcefile != NULL) {
+        route_matrix(&router, sourcefile, (targetfile != NULL) ? targetfile : sourcefile, matrixfile, pathfile, nworkers);
+        overlay_close(&updates);
+        if (router.alt != NULL) landmarks_close(&alt);
+        if (router.ch != NULL) ch_close(&ch);
+        graph_close(&graph);
+        return 0;
+    }
+
+    Histogram hist;
+    memset(&hist, 0, sizeof(Histogram));
+    QueryLog query_log = {NULL, histogram ? &hist : NULL};
+    if (jsonfile != NULL) {
+        if (strcmp(jsonfile, "-") == 0) query_log.json = stderr;
+        else if ((query_log.json = fopen(jsonfile, "w")) == NULL) ExitError("the statistics file cannot be created", 2);
+    }
+    QueryLog* log = (jsonfile != NULL || histogram) ? &query_log : NULL;
+
+    if (queryfile != NULL) {
+        route_batch(&router, queryfile, nworkers, stdout, log);
+        if (histogram) print_histogram(stderr, &hist);
+        if (query_log.json != NULL && query_log.json != stderr) fclose(query_log.json);
+        overlay_close(&updates);
+        if (router.alt != NULL) landmarks_close(&alt);
+        if (router.ch != NULL) ch_close(&ch);
+        graph_close(&graph);
+        return 0;
+    }
+
+    SearchState S;
+    search_init(&S, graph.nnodes);
+
+    if (sockpath != NULL) serve_socket(&router, &S, sockpath, log);
+    else if (server) serve(&router, &S, stdin, stdout, log);
+    else {
+        unsigned long source = 240949599;             //SOURCE NODE'S ID
+        unsigned long dest = 195977239;               //DESTINATION NODE'S ID
+        char mode = 'a';
+        SuboptimalLimits limits = {DEFAULT_EPSILON, 0, 0};
+        OverlaySnapshot* snap;
+        Router current = router_snapshot(&router, &snap);
+        if (optind + 2 < argc) {
+            //The arguments after the file are a query line.
+            char line[1024] = "";
+            int k;
+            for (k = optind + 1; k < argc && strlen(line) + strlen(argv[k]) + 2 < sizeof(line); k++) {
+                strcat(line, argv[k]);
+                strcat(line, " ");
+            }
+            if (!parse_query(current.graph, line, &source, &dest, &mode, &limits))
+                ExitError("the query is not valid: source dest [a|b|l|c|w|r [epsilon [ms [expansions]]]] (node ids or lat,lon)", 9);
+        }
+        unsigned long source_index = searchNode(source, &graph);
+        unsigned long dest_index   = searchNode(dest, &graph);
+        if (source_index >= graph.nnodes || dest_index >= graph.nnodes) ExitError("the source or destination node is not in the graph", 9);
+        if (mode == 'l' && router.alt == NULL) ExitError("there are no landmarks for this graph (run write_alt first)", 9);
+        if (mode == 'c' && router.ch == NULL) ExitError("there is no hierarchy for this graph (run write_ch first)", 9);
+        if ((mode == 'l' && current.alt == NULL) || (mode == 'c' && current.ch == NULL))
+            ExitError("the updates make this mode invalid until the graph is compacted (see compact)", 9);
+
+        clock_t start, end;
+        S.timed = (log != NULL);
+        double t0 = now();
+        start = clock();
+        if (!run_search(&current, &S, mode, &limits, source_index, dest_index)) ExitError("OPEN list is empty before reaching destination", 5);
+        end = clock();
+        unsigned long path_len = rebuild_path(&S, source_index, dest_index);
+        printf("DESTINATION REACHED! Check SROutput.txt file.\n");
+        printf("%s distance: %.6f meters.\n", (mode == 'w' || mode == 'r') ? "Path" : "Optimal", S.distance*1000);
+        printf("A* time elapsed: %.6f seconds.\n", ((double) (end - start)) / CLOCKS_PER_SEC);
+        printf("Expanded nodes: %lu forward, %lu backward.\n", S.expanded_nodes_counter, S.expanded_backward);
+        if (mode == 'w' || mode == 'r') printf("At most %.6f times the shortest distance.\n", S.bound);
+
+        double t1 = now();
+        output_txt(&graph, S.path, path_len, S.path_g, binfile);
+        S.stats.output_time = now() - t1;
+        if (log != NULL) log_query(log, &S, source, dest, mode, NULL, path_len, now() - t0);
+        overlay_release(&updates, snap);
+    }
+    if (histogram) print_histogram(stderr, &hist);
+    if (query_log.json != NULL && query_log.json != stderr) fclose(query_log.json);
+
+    search_free(&S);
+    overlay_close(&updates);
+    if (router.alt != NULL) landmarks_close(&alt);
+    if (router.ch != NULL) ch_close(&ch);
+    graph_close(&graph);
             
     return 0;
-}
\ No newline at end of file
+}
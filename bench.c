@@ -0,0 +1,239 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include "search.h"
+
+/*Routing benchmark: bench [-n queries] [-s seed] [-m modes] [-w write] map.csv | map.bin
+
+Given a csv file it first runs the converter on it (./write by default) and times it. It then maps
+the .bin file with its .alt and .ch files, draws a seeded random set of queries in three buckets of
+straight-line distance (local, medium and long, relative to the size of the map) and routes them in
+every mode. The results go to stdout as one JSON document: the conversion and load times, and per
+mode and bucket the latency percentiles, the expanded nodes per second and the peak RSS. The same
+file, seed and number of queries always give the same queries, so runs before and after a change
+can be compared directly. Generate a map with gen_map to run it without an OSM extract.*/
+
+#define BUCKETS     3
+#define MAX_TRIES   1000            //Draws per query before a bucket is given up (a tiny map has no long queries)
+
+static const char* bucket_name[BUCKETS] = {"local", "medium", "long"};
+static const double bucket_limit[BUCKETS] = {1.0/16, 1.0/4, INFINITY};     //Fraction of the diagonal of the map
+
+
+void ExitError(const char *miss, int errcode) {
+    fprintf (stderr, "\nERROR: %s.\nStopping...\n\n", miss); exit(errcode);
+}
+
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+//splitmix64, as in gen_map.c, so that the queries do not depend on the C library.
+static uint64_t next_random(uint64_t* state) {
+    uint64_t z = (*state += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+static int compare_double(const void* a, const void* b) {
+    double x = *(const double*)a, y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+//Nearest-rank percentile of a sorted array.
+static double percentile(const double* sorted, unsigned long n, double p) {
+    unsigned long k = (unsigned long) ceil(p / 100 * n);
+    return sorted[(k > 0) ? k - 1 : 0];
+}
+
+
+//Prints s as a JSON string.
+static void print_json_string(const char* s) {
+    putchar('"');
+    for (; *s != '\0'; s++) {
+        if (*s == '"' || *s == '\\') printf("\\%c", *s);
+        else if ((unsigned char)*s < 0x20) printf("\\u%04x", (unsigned char)*s);
+        else putchar(*s);
+    }
+    putchar('"');
+}
+
+
+/*Runs the converter on csvfile and waits for it. Returns its wall time and stores its peak RSS (in
+KB). Its own report goes to stderr, so that stdout only holds the JSON.*/
+static double run_converter(const char* writer, const char* csvfile, long* peak_rss) {
+    double t0 = now();
+    pid_t pid = fork();
+    if (pid < 0) ExitError("the converter cannot be started", 16);
+    if (pid == 0) {
+        dup2(STDERR_FILENO, STDOUT_FILENO);
+        execl(writer, writer, csvfile, (char*)NULL);
+        _exit(127);
+    }
+    int status;
+    struct rusage ru;
+    if (wait4(pid, &status, 0, &ru) < 0) ExitError("the converter cannot be waited for", 16);
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) ExitError("the converter failed (see -w)", 16);
+    *peak_rss = ru.ru_maxrss;
+    return now() - t0;
+}
+
+
+typedef struct {
+    const Graph* graph;
+    const Landmarks* alt;
+    const CHGraph* ch;
+} Router;
+
+static bool mode_available(const Router* r, char mode) {
+    if (mode == 'a' || mode == 'b') return true;
+    if (mode == 'l') return r->alt != NULL;
+    if (mode == 'c') return r->ch != NULL;
+    return false;
+}
+
+static bool run_search(const Router* r, SearchState* S, char mode, unsigned long s, unsigned long t) {
+    if (mode == 'b') return BiAStar(r->graph, S, s, t);
+    if (mode == 'l') return AStarALT(r->graph, r->alt, S, s, t);
+    if (mode == 'c') return CHSearch(r->ch, S, s, t);
+    return AStar(r->graph, S, s, t);
+}
+
+
+int main (int argc, char *argv[]) {
+
+    //-n queries sets the number of queries per bucket (100 by default) and -s seed the random queries.
+    //-m modes picks the search modes among a, b, l and c (all the ones the files allow by default).
+    //-w write is the converter run on a csv file (./write by default).
+    unsigned long nqueries = 100;
+    uint64_t seed = 1;
+    const char* modes = "ablc";
+    const char* writer = "./write";
+    bool explicit_modes = false;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:s:m:w:")) != -1) {
+        if (opt == 'n') nqueries = strtoul(optarg, NULL, 10);
+        else if (opt == 's') seed = strtoull(optarg, NULL, 10);
+        else if (opt == 'm') { modes = optarg; explicit_modes = true; }
+        else if (opt == 'w') writer = optarg;
+        else ExitError("usage: bench [-n queries] [-s seed] [-m modes] [-w write] map.csv|map.bin", 1);
+    }
+    if (optind >= argc || nqueries == 0 || modes[strspn(modes, "ablc")] != '\0')
+        ExitError("usage: bench [-n queries (1 or more)] [-s seed] [-m modes (a, b, l, c)] [-w write] map.csv|map.bin", 1);
+    const char* mapfile = argv[optind];
+
+    char binfile[4096], sidefile[4096];
+    double convert_seconds = -1;
+    long convert_rss = 0;
+    const char* dot = strrchr(mapfile, '.');
+    if (dot != NULL && strcmp(dot, ".csv") == 0) {
+        convert_seconds = run_converter(writer, mapfile, &convert_rss);
+        graph_sidecar_path(mapfile, ".bin", binfile, sizeof(binfile));
+    }
+    else snprintf(binfile, sizeof(binfile), "%s", mapfile);
+
+    //Loading maps the files: the pages themselves are read by the first queries that touch them.
+    double t0 = now();
+    Graph graph;
+    const char* err;
+    if ((err = graph_open(&graph, binfile)) != NULL) ExitError(err, 8);
+    Router router = {&graph, NULL, NULL};
+    Landmarks alt;
+    CHGraph ch;
+    graph_sidecar_path(binfile, ".alt", sidefile, sizeof(sidefile));
+    if (access(sidefile, F_OK) == 0 && landmarks_open(&alt, sidefile, &graph) == NULL) router.alt = &alt;
+    graph_sidecar_path(binfile, ".ch", sidefile, sizeof(sidefile));
+    if (access(sidefile, F_OK) == 0 && ch_open(&ch, sidefile, &graph) == NULL) router.ch = &ch;
+    SearchState S;
+    search_init(&S, graph.nnodes);
+    double load_seconds = now() - t0;
+
+    unsigned long n = graph.nnodes, v, b, q;
+    if (n < 2) ExitError("the graph is too small to benchmark", 8);
+    Coord lo = graph_coord(&graph, 0), hi = lo;
+    for (v = 1; v < n; v++) {
+        Coord c = graph_coord(&graph, v);
+        if (c.lat < lo.lat) lo.lat = c.lat;
+        if (c.lat > hi.lat) hi.lat = c.lat;
+        if (c.lon < lo.lon) lo.lon = c.lon;
+        if (c.lon > hi.lon) hi.lon = c.lon;
+    }
+    double diagonal = haversine(lo, hi);
+
+    //The queries of every bucket: random pairs of nodes, kept when their distance falls in the bucket.
+    unsigned long (*pairs)[2];
+    unsigned long count[BUCKETS];
+    double* latency;
+    if ((pairs = malloc(BUCKETS*nqueries*sizeof(*pairs))) == NULL ||
+        (latency = (double*) malloc(nqueries*sizeof(double))) == NULL) ExitError("when allocating memory for the queries", 3);
+    uint64_t rng = seed;
+    for (b = 0; b < BUCKETS; b++) {
+        double min = (b == 0) ? 0 : bucket_limit[b-1] * diagonal, max = bucket_limit[b] * diagonal;
+        unsigned long tries = 0;
+        count[b] = 0;
+        while (count[b] < nqueries && tries < MAX_TRIES*nqueries) {
+            unsigned long s = next_random(&rng) % n, t = next_random(&rng) % n;
+            double d = graph_arc(&graph, s, t);
+            tries += 1;
+            if (s == t || d < min || d >= max) continue;
+            pairs[b*nqueries + count[b]][0] = s;
+            pairs[b*nqueries + count[b]][1] = t;
+            count[b] += 1;
+        }
+    }
+
+    printf("{\n  \"map\": ");
+    print_json_string(binfile);
+    printf(",\n  \"nodes\": %lu,\n  \"edges\": %lu,\n  \"seed\": %lu,\n", graph.nnodes, graph.nedges, (unsigned long)seed);
+    if (convert_seconds >= 0) printf("  \"convert\": {\"seconds\": %.6f, \"peak_rss_kb\": %ld},\n", convert_seconds, convert_rss);
+    else printf("  \"convert\": null,\n");
+    printf("  \"load_seconds\": %.6f,\n  \"diagonal_km\": %.3f,\n  \"results\": [", load_seconds, diagonal);
+    bool first = true;
+    const char* m;
+    for (m = modes; *m != '\0'; m++) {
+        if (!mode_available(&router, *m)) {
+            if (explicit_modes) fprintf(stderr, "Skipping mode %c: its file is missing or stale.\n", *m);
+            continue;
+        }
+        for (b = 0; b < BUCKETS; b++) {
+            if (count[b] == 0) continue;
+            unsigned long found = 0, expanded = 0;
+            double total = 0;
+            for (q = 0; q < count[b]; q++) {
+                double t1 = now();
+                if (run_search(&router, &S, *m, pairs[b*nqueries + q][0], pairs[b*nqueries + q][1])) found += 1;
+                latency[q] = now() - t1;
+                total += latency[q];
+                expanded += S.expanded_nodes_counter + S.expanded_backward;
+            }
+            qsort(latency, count[b], sizeof(double), compare_double);
+            printf("%s\n    {\"mode\": \"%c\", \"bucket\": \"%s\", \"queries\": %lu, \"found\": %lu, "
+                   "\"p50_ms\": %.4f, \"p95_ms\": %.4f, \"p99_ms\": %.4f, \"mean_ms\": %.4f, \"expanded\": %lu, \"expansions_per_second\": %.0f}",
+                   first ? "" : ",", *m, bucket_name[b], count[b], found, percentile(latency, count[b], 50) * 1e3,
+                   percentile(latency, count[b], 95) * 1e3, percentile(latency, count[b], 99) * 1e3, total / count[b] * 1e3,
+                   expanded, (total > 0) ? expanded / total : 0);
+            first = false;
+        }
+    }
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    printf("\n  ],\n  \"peak_rss_kb\": %ld\n}\n", ru.ru_maxrss);
+
+    free(pairs);
+    free(latency);
+    search_free(&S);
+    if (router.alt != NULL) landmarks_close(&alt);
+    if (router.ch != NULL) ch_close(&ch);
+    graph_close(&graph);
+    return 0;
+}
@@ -0,0 +1,91 @@
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "ch.h"
+
+
+//Returns a pointer to a section of the mapping after checking its bounds, alignment and size.
+static const void* ch_section(const CHHeader* hdr, size_t maplen, int kind, uint64_t expected, const char** err) {
+    const GraphSection* s = &hdr->section[kind];
+    if (s->offset == 0 || s->offset % GRAPH_ALIGN != 0 || s->offset > maplen || s->size > maplen - s->offset || s->size != expected) {
+        *err = "the hierarchy file is truncated or corrupt";
+        return NULL;
+    }
+    return (const char*)hdr + s->offset;
+}
+
+/*Maps a hierarchy file and checks that it belongs to the graph g. Returns NULL on success or a
+message describing why the file cannot be used.*/
+const char* ch_open(CHGraph* ch, const char* path, const Graph* g) {
+    int fd;
+    struct stat st;
+    if ((fd = open(path, O_RDONLY)) < 0) return "the hierarchy file cannot be opened";
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(CHHeader)) {
+        close(fd);
+        return "the hierarchy file is too small to hold a header";
+    }
+    void* map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return "the hierarchy file cannot be mapped";
+
+    const CHHeader* hdr = (const CHHeader*) map;
+    size_t maplen = (size_t)st.st_size;
+    const char* err = NULL;
+    if (memcmp(hdr->magic, CH_MAGIC, sizeof(hdr->magic)) != 0) err = "the hierarchy file is not a hierarchy file (run write_ch first)";
+    else if (hdr->endian != GRAPH_ENDIAN_TAG) err = "the hierarchy file was written with a different byte order";
+    else if (hdr->version != CH_VERSION) err = "the hierarchy file has an unsupported version (run write_ch again)";
+    else if (hdr->nnodes != g->nnodes || hdr->stamp != graph_stamp(g)) err = "the hierarchy file was computed for another graph (run write_ch again)";
+    else if (hdr->nup > maplen || hdr->ndown > maplen) err = "the hierarchy file is truncated or corrupt";
+    if (err != NULL) { munmap(map, maplen); return err; }
+
+    uint64_t n = hdr->nnodes;
+    ch->rank = (const NodeIndex*) ch_section(hdr, maplen, CH_RANK, n*sizeof(NodeIndex), &err);
+    if (!err) ch->up_offsets = (const uint64_t*) ch_section(hdr, maplen, CH_UP_OFFSETS, (n+1)*sizeof(uint64_t), &err);
+    if (!err) ch->up = (const CHEdge*) ch_section(hdr, maplen, CH_UP_EDGES, hdr->nup*sizeof(CHEdge), &err);
+    if (!err) ch->down_offsets = (const uint64_t*) ch_section(hdr, maplen, CH_DOWN_OFFSETS, (n+1)*sizeof(uint64_t), &err);
+    if (!err) ch->down = (const CHEdge*) ch_section(hdr, maplen, CH_DOWN_EDGES, hdr->ndown*sizeof(CHEdge), &err);
+    if (!err && (ch->up_offsets[n] != hdr->nup || ch->down_offsets[n] != hdr->ndown)) err = "the hierarchy file has inconsistent offsets";
+    if (err != NULL) { munmap(map, maplen); return err; }
+
+    ch->graph = g;
+    ch->nnodes = n;
+    ch->map = map;
+    ch->maplen = maplen;
+    return NULL;
+}
+
+void ch_close(CHGraph* ch) {
+    munmap(ch->map, ch->maplen);
+    ch->map = NULL;
+}
+
+
+//Edge u -> x of the hierarchy: an up edge of u or a down edge of x, whichever has the lower rank.
+const CHEdge* ch_find_edge(const CHGraph* ch, unsigned long u, unsigned long x) {
+    unsigned long e;
+    if (ch->rank[u] < ch->rank[x]) {
+        for (e = ch->up_offsets[u]; e < ch->up_offsets[u+1]; e++) if (ch->up[e].node == x) return &ch->up[e];
+    }
+    else {
+        for (e = ch->down_offsets[x]; e < ch->down_offsets[x+1]; e++) if (ch->down[e].node == u) return &ch->down[e];
+    }
+    return NULL;
+}
+
+/*Unpacks the edge u -> x into the original nodes it goes through, u excluded and x included, and
+returns how many they are. With out == NULL it only counts them. The middle node of a shortcut has
+a lower rank than both ends, so the two halves are found at the middle node.*/
+unsigned long ch_unpack(const CHGraph* ch, unsigned long u, unsigned long x, unsigned long* out) {
+    const CHEdge* edge = ch_find_edge(ch, u, x);
+    if (edge == NULL) ExitError("the hierarchy file has a shortcut without its halves", 22);
+    if (edge->middle == CH_NO_MIDDLE) {
+        if (out != NULL) *out = x;
+        return 1;
+    }
+    unsigned long m = (unsigned long) edge->middle;
+    unsigned long k = ch_unpack(ch, u, m, out);
+    return k + ch_unpack(ch, m, x, (out != NULL) ? out + k : NULL);
+}
@@ -0,0 +1,68 @@
+#ifndef CH_H
+#define CH_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "graph.h"
+
+/*Contraction hierarchy of a graph, written by write_ch.c next to the .bin (map.bin -> map.ch) and
+memory mapped by Astar.c.
+
+The nodes are contracted one after the other in rank order. Contracting a node v removes it from
+the graph and, for every pair of neighbours u -> v -> x whose shortest path goes through v, adds a
+shortcut u -> x with middle node v. Every edge (original or shortcut) is then stored at its lower
+ranked end: the up edges of u go to higher ranked nodes and the down edges of x come from higher
+ranked nodes. A query searches up from the source on the up edges and up from the destination on
+the down edges, backwards, and the two searches meet at the highest ranked node of the path.
+
+    CH_RANK           NodeIndex[nnodes]     contraction order of every node
+    CH_UP_OFFSETS     uint64_t[nnodes+1]    up edges of u are up[up_offsets[u] .. up_offsets[u+1]-1]
+    CH_UP_EDGES       CHEdge[nup]           node = head of the edge
+    CH_DOWN_OFFSETS   uint64_t[nnodes+1]    down edges of x are down[down_offsets[x] .. down_offsets[x+1]-1]
+    CH_DOWN_EDGES     CHEdge[ndown]         node = tail of the edge
+
+Shortcut weights are the sums of the original edge weights in double precision, and there is one
+edge at most between two nodes in each direction.*/
+
+#define CH_MAGIC        "ASTARCHG"
+#define CH_VERSION      2
+#define CH_NO_MIDDLE    UINT32_MAX          //Middle node of an original edge
+
+enum chSection {CH_RANK, CH_UP_OFFSETS, CH_UP_EDGES, CH_DOWN_OFFSETS, CH_DOWN_EDGES, CH_SECTIONS};
+
+typedef struct {
+    NodeIndex node;             //The other end of the edge
+    NodeIndex middle;           //Node a shortcut skips, CH_NO_MIDDLE for an original edge
+    double weight;
+} CHEdge;
+
+typedef struct {
+    char magic[8];
+    uint32_t endian;
+    uint32_t version;
+    uint64_t nnodes;
+    uint64_t stamp;             //graph_stamp() of the graph
+    uint64_t nup, ndown;
+    GraphSection section[CH_SECTIONS];
+} CHHeader;
+
+//A mapped hierarchy and the graph it was computed for.
+typedef struct {
+    const Graph* graph;
+    unsigned long nnodes;
+    const NodeIndex* rank;
+    const uint64_t* up_offsets;
+    const CHEdge* up;
+    const uint64_t* down_offsets;
+    const CHEdge* down;
+    void* map;
+    size_t maplen;
+} CHGraph;
+
+
+const char* ch_open(CHGraph* ch, const char* path, const Graph* g);
+void ch_close(CHGraph* ch);
+const CHEdge* ch_find_edge(const CHGraph* ch, unsigned long u, unsigned long x);
+unsigned long ch_unpack(const CHGraph* ch, unsigned long u, unsigned long x, unsigned long* out);
+
+#endif
@@ -0,0 +1,230 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <math.h>
+#include <time.h>
+#include <inttypes.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include "graph.h"
+#include "grid.h"
+#include "overlay.h"
+
+/*Compaction of the update log (see overlay.h): compact [-u updates] [-o out.bin] map.bin
+
+Reads map.bin and the updates of map.upd (or of -u file), and writes the graph with the updates
+merged in, in the format and with the encodings of map.bin: the same nodes in the same order, the
+new adjacency and its reverse, and a new spatial grid, as some nodes may have lost or gained their
+only successor. The lengths are the ones the router used with the log, so both give the same
+distances. The reverse adjacency is only written if the result has one-way edges.
+
+The file is written next to its destination and renamed over it, so map.bin itself can be the
+output (the default) while a router has it mapped. The log is left as it is, with a marker that
+says how much of it the new graph holds: a router on the new graph skips those lines, and one still
+running on the old file keeps applying them, so neither loses an update. The .alt and .ch files of
+the old graph no longer match the new one (its stamp covers the edges and their lengths) and are
+ignored: run write_alt and write_ch again.*/
+
+
+void ExitError(const char *miss, int errcode) {
+    fprintf (stderr, "\nERROR: %s.\nStopping...\n\n", miss); exit(errcode);
+}
+
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static int compare_key(const void* a, const void* b) {
+    uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+    return (x > y) - (x < y);
+}
+
+//A length as its 4 stored bytes: the updates are already rounded, so this only undoes graph_weight().
+static uint32_t stored_weight(const Graph* g, double w) {
+    if (g->weight_encoding == WEIGHT_FIXED) {
+        double v = round(w / g->weight_unit);
+        if (v > UINT32_MAX) ExitError("an edge weight does not fit the fixed-point precision", 13);
+        return (uint32_t)v;
+    }
+    float f = (float)w;
+    uint32_t bits;
+    memcpy(&bits, &f, sizeof(bits));
+    return bits;
+}
+
+//Whether every edge u -> v has a twin v -> u of the same length, as in a map without one-way streets.
+static bool is_symmetric(unsigned long n, const uint64_t* offsets, const NodeIndex* targets, const uint32_t* weights,
+                         const uint64_t* rev_offsets, const NodeIndex* rev_sources, const uint32_t* rev_weights, unsigned long max_degree) {
+    uint64_t *a, *b;
+    unsigned long v, k, len;
+    bool same = true;
+    if ((a = (uint64_t*) malloc((max_degree + 1)*sizeof(uint64_t))) == NULL ||
+        (b = (uint64_t*) malloc((max_degree + 1)*sizeof(uint64_t))) == NULL) ExitError("when allocating memory for the reverse adjacency", 6);
+    for (v = 0; v < n && same; v++) {
+        len = offsets[v+1] - offsets[v];
+        if (len != rev_offsets[v+1] - rev_offsets[v]) same = false;
+        for (k = 0; k < len && same; k++) {
+            a[k] = (uint64_t)targets[offsets[v] + k] << 32 | weights[offsets[v] + k];
+            b[k] = (uint64_t)rev_sources[rev_offsets[v] + k] << 32 | rev_weights[rev_offsets[v] + k];
+        }
+        if (!same) break;
+        qsort(a, len, sizeof(uint64_t), compare_key);
+        qsort(b, len, sizeof(uint64_t), compare_key);
+        same = memcmp(a, b, len*sizeof(uint64_t)) == 0;
+    }
+    free(a);
+    free(b);
+    return same;
+}
+
+/*Appends the marker "merged stamp bytes" to the log (see overlay.h), in one write under an exclusive
+lock, so that it never lands inside a line of another writer that takes the lock too.*/
+static void append_marker(const char* path, uint64_t stamp, off_t bytes) {
+    char line[64];
+    int fd, len = snprintf(line, sizeof(line), "merged %016" PRIx64 " %" PRIu64 "\n", stamp, (uint64_t)bytes);
+    if ((fd = open(path, O_WRONLY | O_APPEND)) < 0 || flock(fd, LOCK_EX) != 0) ExitError("the update log cannot be opened to mark the merged updates", 2);
+    if (write(fd, line, len) != len) ExitError("when marking the merged updates in the update log", 2);
+    flock(fd, LOCK_UN);
+    close(fd);
+}
+
+
+int main (int argc, char *argv[]) {
+
+    //-u updates reads another update log than map.upd and -o out.bin writes the result to another file than map.bin.
+    char* updatefile = NULL;
+    char* outfile = NULL;
+    int opt;
+    while ((opt = getopt(argc, argv, "u:o:")) != -1) {
+        if (opt == 'u') updatefile = optarg;
+        else if (opt == 'o') outfile = optarg;
+        else ExitError("usage: compact [-u updates] [-o out.bin] map.bin", 1);
+    }
+    if (optind >= argc) ExitError("usage: compact [-u updates] [-o out.bin] map.bin", 1);
+    char* binfile = argv[optind];
+    if (outfile == NULL) outfile = binfile;
+    char logfile[4096], tmpfile[4096 + 8];
+    if (updatefile != NULL) snprintf(logfile, sizeof(logfile), "%s", updatefile);
+    else graph_sidecar_path(binfile, ".upd", logfile, sizeof(logfile));
+
+    Graph base;
+    const char* err;
+    if ((err = graph_open(&base, binfile)) != NULL) ExitError(err, 8);
+    double t0 = now();
+    Overlay ov;
+    overlay_open(&ov, &base, logfile);
+    if (ov.nupdates == 0) {
+        printf("No updates in %s: nothing to compact.\n", logfile);
+        overlay_close(&ov);
+        graph_close(&base);
+        return 0;
+    }
+    const Graph* g = &ov.current->graph;
+
+    //The adjacency of the graph with its updates, node by node.
+    unsigned long n = g->nnodes, m = 0, cap = g->nedges + 1024, i, k, len, first;
+    const NodeIndex* succ;
+    NodeIndex *buf, *targets;
+    uint64_t* offsets;
+    uint32_t* weights;
+    if ((buf = (NodeIndex*) malloc((g->max_degree + 1)*sizeof(NodeIndex))) == NULL ||
+        (offsets = (uint64_t*) malloc((n+1)*sizeof(uint64_t))) == NULL ||
+        (targets = (NodeIndex*) malloc(cap*sizeof(NodeIndex))) == NULL ||
+        (weights = (uint32_t*) malloc(cap*sizeof(uint32_t))) == NULL)
+            ExitError("when allocating memory for the successors", 6);
+    for (i = 0; i < n; i++) {
+        offsets[i] = m;
+        len = graph_adjacent(g, false, i, buf, &succ, &first);
+        if (m + len > cap) {
+            cap = 2*(m + len);
+            if ((targets = (NodeIndex*) realloc(targets, cap*sizeof(NodeIndex))) == NULL ||
+                (weights = (uint32_t*) realloc(weights, cap*sizeof(uint32_t))) == NULL)
+                    ExitError("when allocating memory for the successors", 6);
+        }
+        for (k = 0; k < len; k++, m++) {
+            targets[m] = succ[k];
+            weights[m] = stored_weight(g, graph_weight(g, first + k));
+        }
+    }
+    offsets[n] = m;
+    free(buf);
+
+    //The reverse adjacency, by target node and in edge order, so that the sources of every node are increasing.
+    uint64_t *rev_offsets, *cursor;
+    NodeIndex* rev_sources;
+    uint32_t* rev_weights;
+    unsigned long e, max_degree = 0;
+    if ((rev_offsets = (uint64_t*) calloc(n+1, sizeof(uint64_t))) == NULL ||
+        (cursor = (uint64_t*) malloc((n+1)*sizeof(uint64_t))) == NULL ||
+        (rev_sources = (NodeIndex*) malloc((m+1)*sizeof(NodeIndex))) == NULL ||
+        (rev_weights = (uint32_t*) malloc((m+1)*sizeof(uint32_t))) == NULL)
+            ExitError("when allocating memory for the reverse adjacency", 6);
+    for (e = 0; e < m; e++) rev_offsets[targets[e] + 1] += 1;
+    for (i = 0; i < n; i++) {
+        if (rev_offsets[i+1] > max_degree) max_degree = rev_offsets[i+1];
+        if (offsets[i+1] - offsets[i] > max_degree) max_degree = offsets[i+1] - offsets[i];
+        rev_offsets[i+1] += rev_offsets[i];
+    }
+    memcpy(cursor, rev_offsets, (n+1)*sizeof(uint64_t));
+    for (i = 0; i < n; i++)
+        for (e = offsets[i]; e < offsets[i+1]; e++) {
+            rev_sources[cursor[targets[e]]] = (NodeIndex)i;
+            rev_weights[cursor[targets[e]]++] = weights[e];
+        }
+    free(cursor);
+    bool symmetric = is_symmetric(n, offsets, targets, weights, rev_offsets, rev_sources, rev_weights, max_degree);
+
+    GraphGrid grid;
+    uint32_t* grid_cells;
+    NodeIndex* grid_nodes;
+    grid_build(base.coords, offsets, n, &grid, &grid_cells, &grid_nodes);
+
+    //Everything else is the same as in the file.
+    const GraphHeader* hdr = (const GraphHeader*) base.map;
+    bool packed = (base.blocks != NULL);
+    snprintf(tmpfile, sizeof(tmpfile), "%s.tmp", outfile);
+    GraphWriter gw;
+    graph_writer_open(&gw, tmpfile, n, m);
+    gw.hdr.grid = grid;
+    gw.hdr.metric[0] = hdr->metric[0];
+    graph_write_section(&gw, SEC_IDS, base.ids, n*sizeof(uint64_t));
+    graph_write_section(&gw, SEC_COORDS, base.coords, n*sizeof(GraphCoord));
+    graph_write_section(&gw, SEC_UNITVEC, base.unitvecs, n*sizeof(UnitVec));
+    graph_write_adjacency(&gw, false, offsets, targets, packed);
+    graph_write_section(&gw, SEC_NAME_OFFSETS, base.name_offsets, (n+1)*sizeof(uint64_t));
+    graph_write_section(&gw, SEC_NAMES, base.names, base.name_offsets[n]);
+    graph_write_section(&gw, SEC_WEIGHTS, weights, m*sizeof(uint32_t));
+    graph_write_section(&gw, SEC_IDINDEX, base.idindex.slots, idindex_nslots(n)*sizeof(NodeIndex));
+    if (!symmetric) {
+        graph_write_adjacency(&gw, true, rev_offsets, rev_sources, packed);
+        graph_write_section(&gw, SEC_REV_WEIGHTS, rev_weights, m*sizeof(uint32_t));
+    }
+    graph_write_section(&gw, SEC_GRID_CELLS, grid_cells, (2*(uint64_t)grid.rows*grid.cols + 1)*sizeof(uint32_t));
+    graph_write_section(&gw, SEC_GRID_NODES, grid_nodes, n*sizeof(NodeIndex));
+    graph_writer_close(&gw);
+    if (rename(tmpfile, outfile) != 0) ExitError("the compacted graph cannot replace the output file", 2);
+    Graph merged;
+    if ((err = graph_open(&merged, outfile)) != NULL) ExitError(err, 8);
+    uint64_t stamp = graph_stamp(&merged);
+    graph_close(&merged);
+    append_marker(logfile, stamp, ov.read);
+    double t1 = now();
+
+    printf("%lu nodes, %lu edges (%lu before the %lu updates of %s)%s.\n", n, m, base.nedges, ov.nupdates, logfile,
+           symmetric ? "" : ", with a reverse adjacency");
+    printf("Wrote %s in %.3f seconds.\n", outfile, t1 - t0);
+    printf("Marked the first %" PRIu64 " bytes of %s as merged into %s.\n", (uint64_t)ov.read, logfile, outfile);
+    printf("Run write_alt and write_ch again on %s for its landmarks and hierarchy.\n", outfile);
+
+    free(offsets); free(targets); free(weights);
+    free(rev_offsets); free(rev_sources); free(rev_weights);
+    free(grid_cells); free(grid_nodes);
+    overlay_close(&ov);
+    graph_close(&base);
+    return 0;
+}
@@ -0,0 +1,126 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <unistd.h>
+
+/*Synthetic road map in the csv format of write.c, for benchmarks that must run without a real OSM
+extract. The same seed and size always give the same file.
+
+The nodes are the crossings of a width x height grid with about 110 m between neighbours, each one
+moved a little at random. Streets run along the rows and the columns and are cut into ways of 2 to
+8 nodes, some of them one-way and some of them missing, so that the map has dead ends and detours.
+Every AVENUE_EVERY-th row and column is an avenue: a single long two-way way. The node ids are
+handed out in random order, as OSM ids follow the history of the edits rather than the map, and
+the nodes are written sorted by id like an OSM export.*/
+
+#define ONEWAY_PERCENT   15
+#define MISSING_PERCENT   8
+#define AVENUE_EVERY     10
+#define NAMED_PERCENT    30
+
+
+void ExitError(const char *miss, int errcode) {
+    fprintf (stderr, "\nERROR: %s.\nStopping...\n\n", miss); exit(errcode);
+}
+
+
+//splitmix64: a small generator whose sequence does not depend on the C library.
+static uint64_t next_random(uint64_t* state) {
+    uint64_t z = (*state += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+static unsigned long uniform(uint64_t* state, unsigned long n) { return (unsigned long)(next_random(state) % n); }
+static double uniform01(uint64_t* state) { return (next_random(state) >> 11) * (1.0 / 9007199254740992.0); }
+
+
+//Writes a way through n cells of the grid, from cell0 and step cells apart.
+static void write_way(FILE* f, unsigned long* nways, const unsigned long* ids, unsigned long cell0, unsigned long step, unsigned long n,
+                      const char* highway, bool oneway) {
+    unsigned long k;
+    *nways += 1;
+    fprintf(f, "way|%lu|Road %lu||%s|||%s|", *nways, *nways, highway, oneway ? "oneway" : "");
+    for (k = 0; k < n; k++) fprintf(f, "|%lu", ids[cell0 + k*step]);
+    fputc('\n', f);
+}
+
+/*Streets along one line of the grid (a row when step = 1, a column when step = width), cut into
+ways of 2 to 8 nodes. Consecutive ways share their end node.*/
+static void write_streets(FILE* f, uint64_t* rng, unsigned long* nways, const unsigned long* ids, unsigned long cell0, unsigned long step, unsigned long len) {
+    unsigned long x = 0, n;
+    while (x + 1 < len) {
+        n = 2 + uniform(rng, 7);
+        if (x + n > len) n = len - x;
+        bool oneway = uniform(rng, 100) < ONEWAY_PERCENT;
+        if (uniform(rng, 100) >= MISSING_PERCENT) write_way(f, nways, ids, cell0 + x*step, step, n, "residential", oneway);
+        x += n - 1;
+    }
+}
+
+
+int main (int argc, char *argv[]) {
+
+    //-w width and -h height set the size of the grid (300 x 300 by default, height = width if only -w is given).
+    //-s seed picks another map of the same size.
+    unsigned long width = 300, height = 0;
+    uint64_t seed = 1;
+    int opt;
+    while ((opt = getopt(argc, argv, "w:h:s:")) != -1) {
+        if (opt == 'w') width = strtoul(optarg, NULL, 10);
+        else if (opt == 'h') height = strtoul(optarg, NULL, 10);
+        else if (opt == 's') seed = strtoull(optarg, NULL, 10);
+        else ExitError("usage: gen_map [-w width] [-h height] [-s seed] map.csv", 1);
+    }
+    if (optind >= argc || width < 2) ExitError("usage: gen_map [-w width (2 or more)] [-h height] [-s seed] map.csv", 1);
+    if (height < 2) height = width;
+    unsigned long n = width * height, i, x, y;
+
+    //Ids: a random permutation of the cells, with random gaps between consecutive ids.
+    uint64_t rng = seed;
+    unsigned long *ids, *order;
+    if ((ids = (unsigned long*) malloc(n*sizeof(unsigned long))) == NULL ||
+        (order = (unsigned long*) malloc(n*sizeof(unsigned long))) == NULL) ExitError("when allocating memory for the grid", 3);
+    for (i = 0; i < n; i++) order[i] = i;
+    for (i = n - 1; i > 0; i--) {
+        unsigned long j = uniform(&rng, i + 1), t = order[i];
+        order[i] = order[j];
+        order[j] = t;
+    }
+    unsigned long id = 1000;
+    for (i = 0; i < n; i++) {
+        id += 1 + uniform(&rng, 5);
+        ids[order[i]] = id;
+    }
+
+    FILE* f;
+    if ((f = fopen(argv[optind], "w")) == NULL) ExitError("the csv file cannot be opened", 2);
+    fprintf(f, "# type|@id|@name|@place|@highway|@route|@ref|@oneway|@maxspeed|node_lat|node_lon\n");
+    for (i = 0; i < n; i++) {
+        unsigned long cell = order[i];
+        double lat = 40 + (cell / width) * 0.001 + (uniform01(&rng) - 0.5) * 0.0006;
+        double lon = -3 + (cell % width) * 0.0013 + (uniform01(&rng) - 0.5) * 0.0006;
+        if (uniform(&rng, 100) < NAMED_PERCENT) fprintf(f, "node|%lu|Node %lu|||||||%.7f|%.7f\n", ids[cell], ids[cell], lat, lon);
+        else fprintf(f, "node|%lu||||||||%.7f|%.7f\n", ids[cell], lat, lon);
+    }
+
+    fprintf(f, "# type|@id|@name|@place|@highway|@route|@ref|@oneway|@maxspeed|membernodes\n");
+    unsigned long nways = 0;
+    for (y = 0; y < height; y++) {
+        if (y % AVENUE_EVERY == 0) write_way(f, &nways, ids, y*width, 1, width, "primary", false);
+        else write_streets(f, &rng, &nways, ids, y*width, 1, width);
+    }
+    for (x = 0; x < width; x++) {
+        if (x % AVENUE_EVERY == 0) write_way(f, &nways, ids, x, width, height, "primary", false);
+        else write_streets(f, &rng, &nways, ids, x, width, height);
+    }
+    fprintf(f, "relation|1|\n");
+    if (fclose(f) != 0) ExitError("when closing the csv file", 2);
+
+    printf("%lu nodes and %lu ways in %s (seed %lu).\n", n, nways, argv[optind], (unsigned long)seed);
+    free(ids);
+    free(order);
+    return 0;
+}
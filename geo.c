@@ -0,0 +1,100 @@
+#include "geo.h"
+#if GEO_BATCH_WIDTH > 1
+#include <immintrin.h>
+#endif
+
+
+//Position of a point on the unit sphere, with the degrees converted as haversine() converts them.
+UnitVec geo_unitvec(double lat, double lon) {
+    double la = lat * GEO_PI / 180.f, lo = lon * GEO_PI / 180.f;
+    UnitVec u = {cos(la) * cos(lo), cos(la) * sin(lo), sin(la)};
+    return u;
+}
+
+
+#if defined(__AVX2__)
+static inline __m256d asin_poly4(__m256d t) {
+    __m256d p = _mm256_set1_pd(3.47933107596021167570e-05);
+    p = _mm256_add_pd(_mm256_mul_pd(p, t), _mm256_set1_pd(7.91534994289814532176e-04));
+    p = _mm256_add_pd(_mm256_mul_pd(p, t), _mm256_set1_pd(-4.00555345006794114027e-02));
+    p = _mm256_add_pd(_mm256_mul_pd(p, t), _mm256_set1_pd(2.01212532134862925881e-01));
+    p = _mm256_add_pd(_mm256_mul_pd(p, t), _mm256_set1_pd(-3.25565818622400915405e-01));
+    p = _mm256_add_pd(_mm256_mul_pd(p, t), _mm256_set1_pd(1.66666666666666657415e-01));
+    p = _mm256_mul_pd(p, t);
+    __m256d q = _mm256_set1_pd(7.70381505559019352791e-02);
+    q = _mm256_add_pd(_mm256_mul_pd(q, t), _mm256_set1_pd(-6.88283971605453293030e-01));
+    q = _mm256_add_pd(_mm256_mul_pd(q, t), _mm256_set1_pd(2.02094576023350569471e+00));
+    q = _mm256_add_pd(_mm256_mul_pd(q, t), _mm256_set1_pd(-2.40339491173441421878e+00));
+    q = _mm256_add_pd(_mm256_mul_pd(q, t), _mm256_set1_pd(1.0));
+    return _mm256_div_pd(p, q);
+}
+
+//Four distances: both branches of geo_asin() are computed and the right one is picked per lane.
+static inline __m256d arc4(__m256d x, __m256d y, __m256d z, UnitVec to) {
+    __m256d dx = _mm256_sub_pd(x, _mm256_set1_pd(to.x));
+    __m256d dy = _mm256_sub_pd(y, _mm256_set1_pd(to.y));
+    __m256d dz = _mm256_sub_pd(z, _mm256_set1_pd(to.z));
+    __m256d c2 = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(dx, dx), _mm256_mul_pd(dy, dy)), _mm256_mul_pd(dz, dz));
+    __m256d half = _mm256_min_pd(_mm256_mul_pd(_mm256_set1_pd(0.5), _mm256_sqrt_pd(c2)), _mm256_set1_pd(1.0));
+    __m256d small = _mm256_add_pd(half, _mm256_mul_pd(half, asin_poly4(_mm256_mul_pd(half, half))));
+    __m256d t = _mm256_mul_pd(_mm256_sub_pd(_mm256_set1_pd(1.0), half), _mm256_set1_pd(0.5));
+    __m256d s = _mm256_sqrt_pd(t);
+    __m256d large = _mm256_sub_pd(_mm256_set1_pd(1.57079632679489661923),
+                                  _mm256_mul_pd(_mm256_set1_pd(2.0), _mm256_add_pd(s, _mm256_mul_pd(s, asin_poly4(t)))));
+    __m256d a = _mm256_blendv_pd(small, large, _mm256_cmp_pd(half, _mm256_set1_pd(0.5), _CMP_GE_OQ));
+    return _mm256_mul_pd(_mm256_set1_pd(2.0 * GEO_EARTH_RADIUS), a);
+}
+#elif defined(__SSE2__)
+static inline __m128d asin_poly2(__m128d t) {
+    __m128d p = _mm_set1_pd(3.47933107596021167570e-05);
+    p = _mm_add_pd(_mm_mul_pd(p, t), _mm_set1_pd(7.91534994289814532176e-04));
+    p = _mm_add_pd(_mm_mul_pd(p, t), _mm_set1_pd(-4.00555345006794114027e-02));
+    p = _mm_add_pd(_mm_mul_pd(p, t), _mm_set1_pd(2.01212532134862925881e-01));
+    p = _mm_add_pd(_mm_mul_pd(p, t), _mm_set1_pd(-3.25565818622400915405e-01));
+    p = _mm_add_pd(_mm_mul_pd(p, t), _mm_set1_pd(1.66666666666666657415e-01));
+    p = _mm_mul_pd(p, t);
+    __m128d q = _mm_set1_pd(7.70381505559019352791e-02);
+    q = _mm_add_pd(_mm_mul_pd(q, t), _mm_set1_pd(-6.88283971605453293030e-01));
+    q = _mm_add_pd(_mm_mul_pd(q, t), _mm_set1_pd(2.02094576023350569471e+00));
+    q = _mm_add_pd(_mm_mul_pd(q, t), _mm_set1_pd(-2.40339491173441421878e+00));
+    q = _mm_add_pd(_mm_mul_pd(q, t), _mm_set1_pd(1.0));
+    return _mm_div_pd(p, q);
+}
+
+//Two distances, as arc4() (SSE2 has no blend: the lanes are picked with and/andnot).
+static inline __m128d arc2(__m128d x, __m128d y, __m128d z, UnitVec to) {
+    __m128d dx = _mm_sub_pd(x, _mm_set1_pd(to.x));
+    __m128d dy = _mm_sub_pd(y, _mm_set1_pd(to.y));
+    __m128d dz = _mm_sub_pd(z, _mm_set1_pd(to.z));
+    __m128d c2 = _mm_add_pd(_mm_add_pd(_mm_mul_pd(dx, dx), _mm_mul_pd(dy, dy)), _mm_mul_pd(dz, dz));
+    __m128d half = _mm_min_pd(_mm_mul_pd(_mm_set1_pd(0.5), _mm_sqrt_pd(c2)), _mm_set1_pd(1.0));
+    __m128d small = _mm_add_pd(half, _mm_mul_pd(half, asin_poly2(_mm_mul_pd(half, half))));
+    __m128d t = _mm_mul_pd(_mm_sub_pd(_mm_set1_pd(1.0), half), _mm_set1_pd(0.5));
+    __m128d s = _mm_sqrt_pd(t);
+    __m128d large = _mm_sub_pd(_mm_set1_pd(1.57079632679489661923),
+                               _mm_mul_pd(_mm_set1_pd(2.0), _mm_add_pd(s, _mm_mul_pd(s, asin_poly2(t)))));
+    __m128d ge = _mm_cmpge_pd(half, _mm_set1_pd(0.5));
+    __m128d a = _mm_or_pd(_mm_and_pd(ge, large), _mm_andnot_pd(ge, small));
+    return _mm_mul_pd(_mm_set1_pd(2.0 * GEO_EARTH_RADIUS), a);
+}
+#endif
+
+//out[i] = distance in km from node nodes[i] to the point to.
+void geo_arc_batch(const UnitVec* vecs, const uint32_t* nodes, unsigned long n, UnitVec to, double* out) {
+    unsigned long i = 0;
+#if defined(__AVX2__)
+    for (; i + 4 <= n; i += 4) {
+        const UnitVec *a = &vecs[nodes[i]], *b = &vecs[nodes[i+1]], *c = &vecs[nodes[i+2]], *d = &vecs[nodes[i+3]];
+        __m256d x = _mm256_set_pd(d->x, c->x, b->x, a->x);
+        __m256d y = _mm256_set_pd(d->y, c->y, b->y, a->y);
+        __m256d z = _mm256_set_pd(d->z, c->z, b->z, a->z);
+        _mm256_storeu_pd(out + i, arc4(x, y, z, to));
+    }
+#elif defined(__SSE2__)
+    for (; i + 2 <= n; i += 2) {
+        const UnitVec *a = &vecs[nodes[i]], *b = &vecs[nodes[i+1]];
+        _mm_storeu_pd(out + i, arc2(_mm_set_pd(b->x, a->x), _mm_set_pd(b->y, a->y), _mm_set_pd(b->z, a->z), to));
+    }
+#endif
+    for (; i < n; i++) out[i] = geo_arc(vecs[nodes[i]], to);
+}
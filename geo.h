@@ -0,0 +1,63 @@
+#ifndef GEO_H
+#define GEO_H
+
+#include <stdint.h>
+#include <math.h>
+
+/*Great-circle distances from unit vectors. Every node gets its position on the unit sphere once,
+when the graph is converted (SEC_UNITVEC), and the distance between two nodes is then read from
+the chord between their vectors: d = 2R asin(|u - v| / 2), which is the haversine formula without
+its trigonometry on the coordinates. The vectors use the same PI and Earth radius as haversine(),
+so both give the same distance up to rounding (a few 1e-9 km).
+
+geo_arc_batch() computes the distances from a list of nodes to one point at a time: with AVX2 four
+of them per instruction, with SSE2 (any x86-64) two, and one by one elsewhere. Every path uses the
+same asin polynomial, so the results do not depend on the instruction set. A search only needs
+the distance of the successors it reaches for the first time, so the batch only pays when it is
+wide: below GEO_BATCH_WIDTH 4 the search computes them one by one instead.*/
+
+#define GEO_PI              3.141592
+#define GEO_EARTH_RADIUS    6371
+//Taken off every distance used as a heuristic, far above the rounding errors, so it stays a lower bound:
+#define GEO_SLACK           1e-8
+
+#if defined(__AVX2__)
+#define GEO_BATCH_WIDTH     4
+#elif defined(__SSE2__)
+#define GEO_BATCH_WIDTH     2
+#else
+#define GEO_BATCH_WIDTH     1
+#endif
+
+typedef struct {
+    double x, y, z;
+} UnitVec;
+
+
+UnitVec geo_unitvec(double lat, double lon);
+void geo_arc_batch(const UnitVec* vecs, const uint32_t* nodes, unsigned long n, UnitVec to, double* out);
+
+/*asin(x) for 0 <= x <= 1 as a rational approximation (the one of fdlibm, within an ulp or two),
+written without branches on the fast path so that the vector versions can follow it step by step.*/
+static inline double geo_asin_poly(double t) {
+    double p = t*(1.66666666666666657415e-01 + t*(-3.25565818622400915405e-01 + t*(2.01212532134862925881e-01 +
+               t*(-4.00555345006794114027e-02 + t*(7.91534994289814532176e-04 + t*3.47933107596021167570e-05)))));
+    double q = 1.0 + t*(-2.40339491173441421878e+00 + t*(2.02094576023350569471e+00 + t*(-6.88283971605453293030e-01 +
+               t*7.70381505559019352791e-02)));
+    return p / q;
+}
+
+static inline double geo_asin(double x) {
+    if (x < 0.5) return x + x*geo_asin_poly(x*x);
+    double t = (1.0 - x) * 0.5, s = sqrt(t);
+    return 1.57079632679489661923 - 2*(s + s*geo_asin_poly(t));
+}
+
+//Great-circle distance in km between two unit vectors.
+static inline double geo_arc(UnitVec u, UnitVec v) {
+    double dx = u.x - v.x, dy = u.y - v.y, dz = u.z - v.z;
+    double half = 0.5 * sqrt(dx*dx + dy*dy + dz*dz);
+    return 2 * GEO_EARTH_RADIUS * geo_asin(half < 1 ? half : 1);
+}
+
+#endif
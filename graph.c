@@ -0,0 +1,460 @@
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "graph.h"
+
+#define PI GEO_PI
+//Earth radius (in km) for the haversine function:
+#define R_t GEO_EARTH_RADIUS
+
+
+//Returns a pointer to a section of the mapping after checking its bounds, alignment and expected size.
+static const void* map_section(const GraphHeader* hdr, size_t maplen, int kind, uint64_t expected, const char** err) {
+    const GraphSection* s = &hdr->section[kind];
+    if (s->offset == 0 || s->offset % GRAPH_ALIGN != 0 || s->offset > maplen || s->size > maplen - s->offset) {
+        *err = "a section of the binary data file is missing or out of bounds";
+        return NULL;
+    }
+    if (expected != (uint64_t)-1 && s->size != expected) {
+        *err = "a section of the binary data file does not match the header sizes";
+        return NULL;
+    }
+    return (const char*)hdr + s->offset;
+}
+
+
+//Eight bytes from p as a little-endian word, the order of the bits of the packed deltas.
+static inline uint64_t load_le64(const uint8_t* p) {
+    uint64_t w;
+    memcpy(&w, p, sizeof(w));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    w = __builtin_bswap64(w);
+#endif
+    return w;
+}
+
+
+//Checks a plain adjacency of m edges: offsets that never decrease, no list longer than max_degree and every target a node.
+static const char* check_plain(const uint64_t* offsets, const NodeIndex* targets, uint64_t n, uint64_t m, uint64_t max_degree) {
+    uint64_t i, e;
+    if (offsets[0] != 0 || offsets[n] != m) return "the binary data file has inconsistent successor offsets";
+    for (i = 0; i < n; i++)
+        if (offsets[i+1] < offsets[i] || offsets[i+1] - offsets[i] > max_degree) return "the binary data file has inconsistent successor offsets";
+    for (e = 0; e < m; e++)
+        if (targets[e] >= n) return "the binary data file has an edge to a node out of range";
+    return NULL;
+}
+
+/*Checks the block table of a packed adjacency of m edges and every block as graph_unpack() reads it:
+its width, lengths that add up to its edges and are not longer than max_degree, deltas that end
+before the next block, and targets that are nodes.*/
+static const char* check_blocks(const GraphBlock* blocks, uint64_t nblocks, const uint8_t* packed, uint64_t size, uint64_t n, uint64_t m, uint64_t max_degree) {
+    uint64_t b, len[GRAPH_BLOCK_NODES], sum, pos, z, k;
+    unsigned int bits, v, shift;
+    if (size < 8 || blocks[0].byte != 0 || blocks[0].edge != 0 || blocks[nblocks].byte > size - 8 || blocks[nblocks].edge != m)
+        return "the binary data file has an inconsistent packed adjacency";
+    for (b = 0; b < nblocks; b++) {
+        const uint8_t *p = packed + blocks[b].byte, *end = packed + blocks[b+1].byte;
+        if (end <= p || blocks[b+1].edge < blocks[b].edge || (bits = *p++) > 33) return "the binary data file has an inconsistent packed adjacency";
+        for (v = 0, sum = 0; v < GRAPH_BLOCK_NODES; v++) {
+            for (len[v] = 0, shift = 0; p < end && shift < 63 && (*p & 0x80); p++, shift += 7) len[v] |= (uint64_t)(*p & 0x7f) << shift;
+            if (p == end || shift >= 63) return "the binary data file has an inconsistent packed adjacency";
+            len[v] |= (uint64_t)*p++ << shift;
+            if (len[v] > max_degree) return "the binary data file has an inconsistent packed adjacency";
+            sum += len[v];
+        }
+        if (sum != blocks[b+1].edge - blocks[b].edge || (sum*bits + 7) / 8 > (uint64_t)(end - p))
+            return "the binary data file has an inconsistent packed adjacency";
+        uint64_t mask = (1ULL << bits) - 1;
+        for (v = 0, pos = 0; v < GRAPH_BLOCK_NODES; v++) {
+            int64_t prev = (int64_t)(b*GRAPH_BLOCK_NODES + v);
+            for (k = 0; k < len[v]; k++, pos += bits) {
+                z = (load_le64(p + (pos >> 3)) >> (pos & 7)) & mask;
+                prev += (int64_t)(z >> 1) ^ -(int64_t)(z & 1);
+                if (prev < 0 || (uint64_t)prev >= n) return "the binary data file has an edge to a node out of range";
+            }
+        }
+    }
+    return NULL;
+}
+
+//Checks the spatial grid (cells whose ranges never decrease, nodes in range), the id index slots and the name offsets.
+static const char* check_indexes(const Graph* g, const NodeIndex* idslots, uint64_t nslots, uint64_t ncells) {
+    uint64_t n = g->nnodes, i;
+    if (g->grid_cells[0] != 0 || g->grid_cells[2*ncells] != n) return "the binary data file has a corrupt spatial grid";
+    for (i = 0; i < 2*ncells; i++)
+        if (g->grid_cells[i+1] < g->grid_cells[i]) return "the binary data file has a corrupt spatial grid";
+    for (i = 0; i < n; i++)
+        if (g->grid_nodes[i] >= n) return "the binary data file has a corrupt spatial grid";
+    for (i = 0; i < nslots; i++)
+        if (idslots[i] > n) return "the binary data file has a corrupt id index";
+    for (i = 0; i < n; i++)
+        if (g->name_offsets[i+1] < g->name_offsets[i]) return "the binary data file has inconsistent name offsets";
+    return NULL;
+}
+
+/*Maps a .bin file and points the graph arrays inside the mapping. Returns NULL on success or a
+message describing why the file cannot be used. Every index the searches follow is checked once
+here (offsets, targets, lengths of the packed lists, grid, id slots), in time linear in the size of
+the graph, so that a damaged file is refused instead of read out of bounds.*/
+const char* graph_open(Graph* g, const char* path) {
+    int fd;
+    struct stat st;
+    if ((fd = open(path, O_RDONLY)) < 0) return "the binary data file cannot be opened";
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(GraphHeader)) {
+        close(fd);
+        return "the binary data file is too small to hold a header";
+    }
+    void* map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return "the binary data file cannot be mapped";
+
+    const GraphHeader* hdr = (const GraphHeader*) map;
+    size_t maplen = (size_t)st.st_size;
+    const char* err = NULL;
+    if (memcmp(hdr->magic, GRAPH_MAGIC, sizeof(hdr->magic)) != 0) err = "the binary data file is not a graph file (run write first)";
+    else if (hdr->endian != GRAPH_ENDIAN_TAG)
+        err = (hdr->endian == __builtin_bswap32(GRAPH_ENDIAN_TAG)) ? "the binary data file was written with a different byte order" : "the binary data file has a corrupt header";
+    else if (hdr->version != GRAPH_VERSION) err = "the binary data file has an unsupported version (convert the csv file again)";
+    if (err != NULL) { munmap(map, maplen); return err; }
+
+    uint64_t n = hdr->nnodes, m = hdr->nedges;
+    if (n > maplen || m > maplen || n > GRAPH_MAX_NODES) { munmap(map, maplen); return "the binary data file has a corrupt header"; }
+    g->nnodes = n;
+    g->nedges = m;
+    g->ids          = (const uint64_t*) map_section(hdr, maplen, SEC_IDS, n*sizeof(uint64_t), &err);
+    if (!err) g->coords       = (const GraphCoord*) map_section(hdr, maplen, SEC_COORDS, n*sizeof(GraphCoord), &err);
+    uint64_t nblocks = (n + GRAPH_BLOCK_NODES - 1) / GRAPH_BLOCK_NODES;
+    bool packed = (hdr->adjacency == ADJ_PACKED);
+    g->offsets = g->rev_offsets = NULL;
+    g->targets = g->rev_sources = NULL;
+    g->blocks = g->rev_blocks = NULL;
+    g->packed = g->rev_packed = NULL;
+    if (!err && hdr->adjacency != ADJ_PLAIN && !packed) err = "the binary data file has an unknown adjacency encoding";
+    if (!err && packed) {
+        g->blocks = (const GraphBlock*) map_section(hdr, maplen, SEC_BLOCKS, (nblocks+1)*sizeof(GraphBlock), &err);
+        if (!err) g->packed = (const uint8_t*) map_section(hdr, maplen, SEC_PACKED, (uint64_t)-1, &err);
+        if (!err) err = check_blocks(g->blocks, nblocks, g->packed, hdr->section[SEC_PACKED].size, n, m, hdr->max_degree);
+    }
+    else if (!err) {
+        g->offsets = (const uint64_t*) map_section(hdr, maplen, SEC_OFFSETS, (n+1)*sizeof(uint64_t), &err);
+        if (!err) g->targets = (const NodeIndex*) map_section(hdr, maplen, SEC_TARGETS, m*sizeof(NodeIndex), &err);
+        if (!err) err = check_plain(g->offsets, g->targets, n, m, hdr->max_degree);
+    }
+    if (!err) g->name_offsets = (const uint64_t*) map_section(hdr, maplen, SEC_NAME_OFFSETS, (n+1)*sizeof(uint64_t), &err);
+    if (!err) g->names        = (const char*) map_section(hdr, maplen, SEC_NAMES, (uint64_t)-1, &err);
+    if (!err && hdr->metric[0].kind != METRIC_DISTANCE) err = "the binary data file has no edge lengths";
+    if (!err) g->weights      = map_section(hdr, maplen, SEC_WEIGHTS, m*4, &err);
+    if (!err) g->unitvecs     = (const UnitVec*) map_section(hdr, maplen, SEC_UNITVEC, n*sizeof(UnitVec), &err);
+    const NodeIndex* idslots = NULL;
+    uint64_t nslots = idindex_nslots(n);
+    if (!err) idslots = (const NodeIndex*) map_section(hdr, maplen, SEC_IDINDEX, nslots*sizeof(NodeIndex), &err);
+    if (!err && g->name_offsets[n] != hdr->section[SEC_NAMES].size) err = "the binary data file has inconsistent name offsets";
+    uint64_t ncells = (uint64_t)hdr->grid.rows * hdr->grid.cols;
+    if (!err && (ncells == 0 || ncells > maplen || !(hdr->grid.dlat > 0) || !(hdr->grid.dlon > 0))) err = "the binary data file has a corrupt spatial grid";
+    if (!err) g->grid_cells   = (const uint32_t*) map_section(hdr, maplen, SEC_GRID_CELLS, (2*ncells+1)*sizeof(uint32_t), &err);
+    if (!err) g->grid_nodes   = (const NodeIndex*) map_section(hdr, maplen, SEC_GRID_NODES, n*sizeof(NodeIndex), &err);
+    if (!err) err = check_indexes(g, idslots, nslots, ncells);
+    if (err != NULL) { munmap(map, maplen); return err; }
+
+    if (packed && hdr->section[SEC_REV_BLOCKS].offset != 0) {
+        g->rev_blocks = (const GraphBlock*) map_section(hdr, maplen, SEC_REV_BLOCKS, (nblocks+1)*sizeof(GraphBlock), &err);
+        if (!err) g->rev_packed = (const uint8_t*) map_section(hdr, maplen, SEC_REV_PACKED, (uint64_t)-1, &err);
+        if (!err) g->rev_weights = map_section(hdr, maplen, SEC_REV_WEIGHTS, m*4, &err);
+        if (!err) err = check_blocks(g->rev_blocks, nblocks, g->rev_packed, hdr->section[SEC_REV_PACKED].size, n, m, hdr->max_degree);
+        if (err != NULL) { munmap(map, maplen); return err; }
+    }
+    else if (!packed && hdr->section[SEC_REV_OFFSETS].offset != 0) {
+        g->rev_offsets = (const uint64_t*) map_section(hdr, maplen, SEC_REV_OFFSETS, (n+1)*sizeof(uint64_t), &err);
+        if (!err) g->rev_sources = (const NodeIndex*) map_section(hdr, maplen, SEC_REV_SOURCES, m*sizeof(NodeIndex), &err);
+        if (!err) g->rev_weights = map_section(hdr, maplen, SEC_REV_WEIGHTS, m*4, &err);
+        if (!err) err = check_plain(g->rev_offsets, g->rev_sources, n, m, hdr->max_degree);
+        if (err != NULL) { munmap(map, maplen); return err; }
+    }
+    else {
+        //No one-way streets: the graph is symmetric and is its own reverse.
+        g->rev_offsets = g->offsets;
+        g->rev_sources = g->targets;
+        g->rev_blocks = g->blocks;
+        g->rev_packed = g->packed;
+        g->rev_weights = g->weights;
+    }
+    idindex_init(&g->idindex, idslots, nslots, g->ids);
+    g->grid = hdr->grid;
+    g->patch = NULL;
+    g->max_degree = hdr->max_degree;
+    g->weight_encoding = (int)hdr->metric[0].encoding;
+    g->weight_unit = (g->weight_encoding == WEIGHT_FIXED) ? 1.0 / hdr->metric[0].scale : 1.0;
+    g->map = map;
+    g->maplen = maplen;
+    return NULL;
+}
+
+void graph_close(Graph* g) {
+    munmap(g->map, g->maplen);
+    g->map = NULL;
+}
+
+//Reads a varint (7 bits per byte, low bits first, the high bit set on all but the last byte).
+static inline const uint8_t* read_varint(const uint8_t* p, uint64_t* value) {
+    uint64_t v = *p & 0x7f;
+    int shift = 7;
+    while (*p++ & 0x80) {
+        v |= (uint64_t)(*p & 0x7f) << shift;
+        shift += 7;
+    }
+    *value = v;
+    return p;
+}
+
+/*Decodes the list of node i from a packed adjacency into buf (see graph_adjacent()). The lengths
+of the block give the index of the first edge of node i and the number of deltas before its own,
+which all have the width of the block, so the first one of node i is found without reading the
+others. Lengths below 128 take a byte each, and then the 8 of a block are one word whose bytes
+before node i are added up at once.*/
+unsigned long graph_unpack(const Graph* g, bool backward, unsigned long i, NodeIndex* buf, unsigned long* first) {
+    unsigned long j = i % GRAPH_BLOCK_NODES, v, k;
+    const GraphBlock* block = (backward ? g->rev_blocks : g->blocks) + i / GRAPH_BLOCK_NODES;
+    const uint8_t* p = (backward ? g->rev_packed : g->packed) + block->byte;
+    unsigned int bits = *p++;
+    uint64_t n = 0, len, before = 0, w = load_le64(p);
+    if (GRAPH_BLOCK_NODES == 8 && (w & 0x8080808080808080ULL) == 0) {
+        uint64_t x = j ? w & (~0ULL >> (64 - 8*j)) : 0;
+        x = (x & 0x00ff00ff00ff00ffULL) + ((x >> 8) & 0x00ff00ff00ff00ffULL);
+        before = (x * 0x0001000100010001ULL) >> 48;
+        n = (w >> 8*j) & 0xff;
+        p += 8;
+    }
+    else {
+        for (v = 0; v < GRAPH_BLOCK_NODES; v++) {
+            p = read_varint(p, &len);
+            if (v < j) before += len;
+            else if (v == j) n = len;
+        }
+    }
+    if (n > g->max_degree) n = g->max_degree;      //Only a corrupt file: never write past buf
+    uint64_t pos = before * bits, mask = (1ULL << bits) - 1, z;
+    int64_t prev = (int64_t)i;
+    for (k = 0; k < n; k++, pos += bits) {
+        z = (load_le64(p + (pos >> 3)) >> (pos & 7)) & mask;
+        prev += (int64_t)(z >> 1) ^ -(int64_t)(z & 1);
+        buf[k] = (NodeIndex)prev;
+    }
+    *first = block->edge + before;
+    return n;
+}
+
+//List of a node of the patch of the graph, which graph_adjacent() has found marked.
+unsigned long graph_patched(const Graph* g, bool backward, unsigned long i, const NodeIndex** targets, unsigned long* first) {
+    const GraphPatch* p = g->patch;
+    const NodeIndex* nodes = p->nodes[backward];
+    const uint64_t* offsets = p->offsets[backward];
+    unsigned long lo = 0, hi = p->count[backward], mid;
+    while (hi - lo > 1) {
+        mid = (lo + hi) / 2;
+        if (nodes[mid] <= i) lo = mid;
+        else hi = mid;
+    }
+    *targets = p->targets + offsets[lo];
+    *first = g->nedges + offsets[lo];
+    return offsets[lo+1] - offsets[lo];
+}
+
+//A length in km as the file would store it, rounded up as graph_write_weights() does.
+double graph_round_weight(const Graph* g, double km) {
+    if (g->weight_encoding == WEIGHT_FIXED) return ceil(km * round(1 / g->weight_unit)) * g->weight_unit;
+    float w = (float)km;
+    if ((double)w < km) w = nextafterf(w, INFINITY);
+    return w;
+}
+
+/*FNV-1a hash of the header of a mapped .bin file, which holds the sizes and the layout of every
+section and the hash of their contents, and of up to 4096 ids spread over the ids array, which catch a different numbering of the
+same nodes (write -o). The files computed from a graph (landmarks, contraction hierarchy) record it
+to detect that the graph has been converted again.*/
+uint64_t graph_stamp(const Graph* g) {
+    const unsigned char* p = (const unsigned char*) g->map;
+    uint64_t h = 14695981039346656037ULL;
+    unsigned long i, step = g->nnodes / 4096 + 1;
+    for (i = 0; i < sizeof(GraphHeader); i++) h = (h ^ p[i]) * 1099511628211ULL;
+    for (i = 0; i < g->nnodes; i += step) h = (h ^ g->ids[i]) * 1099511628211ULL;
+    return h;
+}
+
+//Name of a file kept next to the graph, with the extension ext instead of .bin: map.bin -> map.alt.
+void graph_sidecar_path(const char* binfile, const char* ext, char* path, size_t len) {
+    const char* dot = strrchr(binfile, '.');
+    size_t base = (dot != NULL && strchr(dot, '/') == NULL) ? (size_t)(dot - binfile) : strlen(binfile);
+    if (base + strlen(ext) + 1 > len) base = len - strlen(ext) - 1;
+    memcpy(path, binfile, base);
+    strcpy(path + base, ext);
+}
+
+
+//Writes zeros up to the next aligned offset.
+static void writer_pad(GraphWriter* gw) {
+    static const char zeros[GRAPH_ALIGN];
+    uint64_t next = (gw->pos + GRAPH_ALIGN - 1) & ~(uint64_t)(GRAPH_ALIGN - 1);
+    if (next > gw->pos && fwrite(zeros, 1, next - gw->pos, gw->f) != next - gw->pos)
+        ExitError("when writing to the output binary data file", 10);
+    gw->pos = next;
+}
+
+void graph_writer_open(GraphWriter* gw, const char* path, uint64_t nnodes, uint64_t nedges) {
+    if ((gw->f = fopen(path, "wb")) == NULL) ExitError("the output binary data file cannot be opened", 8);
+    memset(&gw->hdr, 0, sizeof(GraphHeader));
+    memcpy(gw->hdr.magic, GRAPH_MAGIC, sizeof(gw->hdr.magic));
+    gw->hdr.endian = GRAPH_ENDIAN_TAG;
+    gw->hdr.version = GRAPH_VERSION;
+    gw->hdr.nnodes = nnodes;
+    gw->hdr.nedges = nedges;
+    gw->hash = 14695981039346656037ULL;
+    //Room for the header, which is written again with the section table on close:
+    if (fwrite(&gw->hdr, sizeof(GraphHeader), 1, gw->f) != 1) ExitError("when initializing the output binary data file", 9);
+    gw->pos = sizeof(GraphHeader);
+}
+
+/*Adds a section to the hash of the contents of the file: FNV-1a over its kind, its size and its
+words, 8 bytes at a time so that hashing costs little next to writing.*/
+static void writer_hash(GraphWriter* gw, int kind, const void* data, uint64_t size) {
+    const unsigned char* p = (const unsigned char*) data;
+    uint64_t h = gw->hash, w, i;
+    h = (h ^ (uint64_t)kind) * 1099511628211ULL;
+    h = (h ^ size) * 1099511628211ULL;
+    for (i = 0; i + 8 <= size; i += 8) {
+        memcpy(&w, p + i, 8);
+        h = (h ^ w) * 1099511628211ULL;
+    }
+    for (; i < size; i++) h = (h ^ p[i]) * 1099511628211ULL;
+    gw->hash = h;
+}
+
+void graph_write_section(GraphWriter* gw, int kind, const void* data, uint64_t size) {
+    writer_hash(gw, kind, data, size);
+    writer_pad(gw);
+    gw->hdr.section[kind].offset = gw->pos;
+    gw->hdr.section[kind].size = size;
+    if (size > 0 && fwrite(data, 1, size, gw->f) != size) ExitError("when writing a section to the output binary data file", 10);
+    gw->pos += size;
+}
+
+/*Stores one weight per edge, given in double precision, as floats or as fixed-point integers
+(stored value = ceil(weight * scale)). Both round up, so that a stored length is never shorter
+than the exact one.*/
+void graph_write_weights(GraphWriter* gw, int kind, const double* weights, int encoding, double scale) {
+    uint64_t e, m = gw->hdr.nedges;
+    void* data;
+    if ((data = malloc(m*4 + 1)) == NULL) ExitError("when allocating memory for the edge weights", 7);
+    if (encoding == WEIGHT_FLOAT) {
+        float* w = (float*) data;
+        for (e = 0; e < m; e++) {
+            w[e] = (float)weights[e];
+            if ((double)w[e] < weights[e]) w[e] = nextafterf(w[e], INFINITY);
+        }
+    }
+    else {
+        uint32_t* w = (uint32_t*) data;
+        for (e = 0; e < m; e++) {
+            double v = ceil(weights[e] * scale);
+            if (v > UINT32_MAX) ExitError("an edge weight does not fit the fixed-point precision", 13);
+            w[e] = (uint32_t)v;
+        }
+    }
+    graph_write_section(gw, kind, data, m*4);
+    free(data);
+}
+
+//Stores the weights of a metric as floats (fixed_digits < 0) or with fixed_digits decimal digits.
+void graph_write_metric(GraphWriter* gw, int metric, int kind, const double* weights, int fixed_digits) {
+    GraphMetric* desc = &gw->hdr.metric[metric];
+    desc->kind = (uint32_t)kind;
+    desc->encoding = (fixed_digits < 0) ? WEIGHT_FLOAT : WEIGHT_FIXED;
+    desc->scale = (fixed_digits < 0) ? 0 : pow(10, fixed_digits);
+    graph_write_weights(gw, SEC_WEIGHTS + metric, weights, (int)desc->encoding, desc->scale);
+}
+
+static size_t write_varint(uint8_t* p, uint64_t value) {
+    size_t len = 0;
+    while (value >= 0x80) {
+        p[len++] = (uint8_t)(value | 0x80);
+        value >>= 7;
+    }
+    p[len++] = (uint8_t)value;
+    return len;
+}
+
+//Zigzag code of the delta from one target (or the node itself) to the next: small for small deltas of either sign.
+static inline uint64_t zigzag(int64_t delta) {
+    return ((uint64_t)delta << 1) ^ (uint64_t)(delta >> 63);
+}
+
+/*Writes the CSR adjacency of the graph (with backward, the reverse one), as the plain offsets and
+targets or packed into blocks (see graph.h), and raises the longest list of the header. All the
+adjacencies of a file must use the same encoding.*/
+void graph_write_adjacency(GraphWriter* gw, bool backward, const uint64_t* offsets, const NodeIndex* targets, bool packed) {
+    uint64_t i, e, b, n = gw->hdr.nnodes, m = gw->hdr.nedges;
+    for (i = 0; i < n; i++)
+        if (offsets[i+1] - offsets[i] > gw->hdr.max_degree) gw->hdr.max_degree = (uint32_t)(offsets[i+1] - offsets[i]);
+    gw->hdr.adjacency = packed ? ADJ_PACKED : ADJ_PLAIN;
+    if (!packed) {
+        graph_write_section(gw, backward ? SEC_REV_OFFSETS : SEC_OFFSETS, offsets, (n+1)*sizeof(uint64_t));
+        graph_write_section(gw, backward ? SEC_REV_SOURCES : SEC_TARGETS, targets, m*sizeof(NodeIndex));
+        return;
+    }
+    uint64_t nblocks = (n + GRAPH_BLOCK_NODES - 1) / GRAPH_BLOCK_NODES, size = 0;
+    GraphBlock* blocks;
+    uint8_t* bytes;
+    //Per block a width and GRAPH_BLOCK_NODES lengths of 5 bytes at most, and up to 33 bits per delta.
+    if ((blocks = (GraphBlock*) malloc((nblocks+1)*sizeof(GraphBlock))) == NULL ||
+        (bytes = (uint8_t*) calloc(nblocks*(1 + 5*GRAPH_BLOCK_NODES) + 5*m + 8, 1)) == NULL)
+            ExitError("when allocating memory for the packed adjacency", 7);
+    for (b = 0; b < nblocks; b++) {
+        uint64_t start = b*GRAPH_BLOCK_NODES, end = (start + GRAPH_BLOCK_NODES < n) ? start + GRAPH_BLOCK_NODES : n, pos = 0, z;
+        unsigned int bits = 0, k;
+        int64_t prev;
+        for (i = start; i < end; i++)
+            for (e = offsets[i], prev = (int64_t)i; e < offsets[i+1]; prev = targets[e++])
+                while ((zigzag((int64_t)targets[e] - prev) >> bits) != 0) bits += 1;
+        blocks[b].byte = size;
+        blocks[b].edge = offsets[start];
+        bytes[size++] = (uint8_t)bits;
+        //The lengths of the last block are completed with zeros.
+        for (i = start; i < start + GRAPH_BLOCK_NODES; i++) size += write_varint(bytes + size, (i < end) ? offsets[i+1] - offsets[i] : 0);
+        for (i = start; i < end; i++)
+            for (e = offsets[i], prev = (int64_t)i; e < offsets[i+1]; prev = targets[e++], pos += bits) {
+                z = zigzag((int64_t)targets[e] - prev);
+                for (k = 0; k < bits; k++) bytes[size + (pos + k) / 8] |= (uint8_t)(((z >> k) & 1) << ((pos + k) % 8));
+            }
+        size += (pos + 7) / 8;
+    }
+    blocks[nblocks].byte = size;
+    blocks[nblocks].edge = m;
+    graph_write_section(gw, backward ? SEC_REV_BLOCKS : SEC_BLOCKS, blocks, (nblocks+1)*sizeof(GraphBlock));
+    //8 more zero bytes, so that the decoder can read a whole word from anywhere in the lists.
+    graph_write_section(gw, backward ? SEC_REV_PACKED : SEC_PACKED, bytes, size + 8);
+    free(blocks);
+    free(bytes);
+}
+
+void graph_writer_close(GraphWriter* gw) {
+    writer_pad(gw);
+    gw->hdr.content = gw->hash;
+    if (fseek(gw->f, 0, SEEK_SET) != 0 || fwrite(&gw->hdr, sizeof(GraphHeader), 1, gw->f) != 1)
+        ExitError("when writing the header of the output binary data file", 9);
+    if (fclose(gw->f) != 0) ExitError("when closing the output binary data file", 11);
+}
+
+
+//We have chosen the havershine distance to be our heuristic function:
+double haversine (Coord u, Coord v) {
+    double diff_lat = (u.lat - v.lat) * PI / 180.f;
+    double diff_lon = (u.lon - v.lon) * PI / 180.f;
+    double a = pow(sin(diff_lat/2), 2) + cos(u.lat * PI / 180.f) * cos(v.lat * PI / 180.f) * pow(sin(diff_lon/2), 2);
+    double c = 2 * atan2(sqrt(a), sqrt(1-a));
+    double d = R_t * c;
+    return d;
+}
@@ -0,0 +1,245 @@
+#ifndef GRAPH_H
+#define GRAPH_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "idindex.h"
+#include "geo.h"
+
+/*On-disk graph format (.bin v10), written by write.c and memory mapped by Astar.c.
+
+The file starts with a GraphHeader followed by a number of sections. Every section is a plain
+array (no pointers) that starts at a GRAPH_ALIGN aligned offset, so that once the file is mapped
+the arrays can be used in place, without copying or fixing up anything:
+
+    SEC_IDS           uint64_t[nnodes]      OSM id of every node
+    SEC_COORDS        GraphCoord[nnodes]    latitude and longitude in 1e-7 degrees
+    SEC_OFFSETS       uint64_t[nnodes+1]    CSR offsets: successors of i are targets[offsets[i] .. offsets[i+1]-1]
+    SEC_TARGETS       NodeIndex[nedges]     CSR targets (node indices)
+    SEC_NAME_OFFSETS  uint64_t[nnodes+1]    name of i is names[name_offsets[i] .. name_offsets[i+1]-1] (not NUL terminated)
+    SEC_NAMES         char[]                all the names one after the other
+    SEC_WEIGHTS + k   float or uint32_t[nedges]  weight of every CSR edge for metric k (see GraphMetric)
+    SEC_IDINDEX       NodeIndex[nslots]     hash table from OSM id to node index (see idindex.h)
+    SEC_REV_OFFSETS   uint64_t[nnodes+1]    reverse CSR: the nodes with an edge to i are
+    SEC_REV_SOURCES   NodeIndex[nedges]       rev_sources[rev_offsets[i] .. rev_offsets[i+1]-1]
+    SEC_REV_WEIGHTS   as metric 0           length of those edges
+    SEC_UNITVEC       UnitVec[nnodes]       position of every node on the unit sphere (see geo.h)
+    SEC_GRID_CELLS    uint32_t[2*ncells+1]  uniform grid over the coordinates, described by the header
+    SEC_GRID_NODES    NodeIndex[nnodes]       field grid, to snap a point to its nearest node (see grid.h)
+    SEC_BLOCKS        GraphBlock[nblocks+1] packed adjacency (write -z) instead of SEC_OFFSETS and SEC_TARGETS:
+    SEC_PACKED        uint8_t[]               the successor lists, GRAPH_BLOCK_NODES nodes per block
+    SEC_REV_BLOCKS    GraphBlock[nblocks+1] the same for the reverse adjacency, instead of SEC_REV_OFFSETS
+    SEC_REV_PACKED    uint8_t[]               and SEC_REV_SOURCES
+
+The reverse adjacency, used by the backward half of the bidirectional search, is only written when
+the map has one-way streets. Without them every edge has its twin in the other direction and the
+forward arrays are used for both directions.
+
+The arrays a search walks are kept apart from the ones it does not: the ids and the names are only
+read to answer a query, so they never share cache lines with the coordinates and the adjacency.
+Node indices are 32-bit (GRAPH_MAX_NODES nodes at most) and the coordinates are fixed-point
+numbers with the 7 decimal digits OSM itself uses, so a node costs 8 bytes of coordinates and an
+edge 4 bytes of target and 4 of weight. The converter computes the edge lengths from the stored,
+rounded coordinates, so the heuristic and the lengths still agree exactly.
+
+Metric 0 is always the length of the edges in km, computed once by the converter. Its weights
+are rounded up when they are stored, so they never fall below the haversine heuristic and the
+heuristic stays consistent. The other metric slots are there for non-distance weights such as
+travel time.
+
+A packed adjacency codes every target as the zigzag delta from the previous target of its list,
+or from the node itself for the first one. With the nodes numbered along a Hilbert curve (write.c)
+the targets are close to their sources and most deltas take a few bits, against 4 bytes per target
+and 8 per node of offsets in the plain arrays. The nodes go in blocks of GRAPH_BLOCK_NODES: a block
+is the width in bits of its widest delta (one byte), the varint lengths of its lists (completed
+with zeros in the last block) and then all its deltas with that width, bit-packed one after the
+other. The block table gives where every block starts and the index of its first edge, which still
+addresses the weights. A list is read with graph_adjacent(): its first delta is at the sum of the
+lengths before it times the width, so nothing else in the block is decoded. The order of the edges
+is kept, so both encodings give the same searches.
+
+The header also holds a hash of every section written after it (content), so that two files with
+the same sizes but other edges or lengths, such as a graph and its compaction (compact.c), never
+share a graph_stamp().
+
+The endian field holds GRAPH_ENDIAN_TAG as written by the converter, so a file produced on a
+machine with a different byte order is detected instead of being silently misread.*/
+
+#define GRAPH_MAGIC         "ASTARBIN"
+#define GRAPH_VERSION       10
+#define GRAPH_ENDIAN_TAG    0x01020304u
+#define GRAPH_ALIGN         64
+#define GRAPH_MAX_SECTIONS  24
+#define GRAPH_MAX_METRICS   4
+#define GRAPH_MAX_NODES     ((uint64_t)UINT32_MAX - 1)
+#define GRAPH_COORD_SCALE   1e7
+#define GRAPH_BLOCK_NODES   8           //The lengths of a block fit one word (graph_unpack())
+
+enum graphSection {SEC_IDS, SEC_COORDS, SEC_OFFSETS, SEC_TARGETS, SEC_NAME_OFFSETS, SEC_NAMES,
+                   SEC_WEIGHTS, SEC_IDINDEX = SEC_WEIGHTS + GRAPH_MAX_METRICS,
+                   SEC_REV_OFFSETS, SEC_REV_SOURCES, SEC_REV_WEIGHTS, SEC_UNITVEC, SEC_GRID_CELLS, SEC_GRID_NODES,
+                   SEC_BLOCKS, SEC_PACKED, SEC_REV_BLOCKS, SEC_REV_PACKED, SEC_COUNT};
+enum metricKind {METRIC_NONE, METRIC_DISTANCE, METRIC_TIME};
+enum weightEncoding {WEIGHT_FLOAT, WEIGHT_FIXED};
+enum adjacencyEncoding {ADJ_PLAIN, ADJ_PACKED};
+
+typedef struct {
+    uint64_t offset;            //From the start of the file, 0 if the section is not present
+    uint64_t size;              //In bytes
+} GraphSection;
+
+typedef struct {
+    uint32_t kind;              //metricKind, METRIC_NONE if the slot is unused
+    uint32_t encoding;          //weightEncoding
+    double scale;               //WEIGHT_FIXED only: stored value = ceil(weight * scale)
+} GraphMetric;
+
+//Uniform grid of the spatial index: rows x cols cells of dlat x dlon degrees from (lat0, lon0).
+typedef struct {
+    double lat0, lon0;
+    double dlat, dlon;
+    uint32_t rows, cols;
+} GraphGrid;
+
+//Start of a block of the packed adjacency: offset of its first list in the packed bytes and index of its first edge.
+typedef struct {
+    uint64_t byte;
+    uint64_t edge;
+} GraphBlock;
+
+typedef struct {
+    char magic[8];
+    uint32_t endian;
+    uint32_t version;
+    uint64_t nnodes;
+    uint64_t nedges;
+    uint64_t content;           //Hash of all the sections, set by graph_writer_close()
+    uint32_t adjacency;         //adjacencyEncoding
+    uint32_t max_degree;        //Longest successor or predecessor list
+    GraphGrid grid;
+    GraphMetric metric[GRAPH_MAX_METRICS];
+    GraphSection section[GRAPH_MAX_SECTIONS];
+} GraphHeader;
+
+typedef uint32_t NodeIndex;
+
+typedef struct {
+    double lat, lon;
+} Coord;
+
+//Coordinates as stored in the file: degrees * GRAPH_COORD_SCALE, rounded.
+typedef struct {
+    int32_t lat, lon;
+} GraphCoord;
+
+/*Adjacency lists that replace the ones of the file for some nodes, laid over a mapped graph by the
+update log (see overlay.h). The nodes with a new successor list (backward: predecessor list) are
+marked in marks[backward] and listed in increasing order in nodes[backward]: the list of
+nodes[backward][k] is targets[offsets[backward][k] .. offsets[backward][k+1]-1]. Both directions
+share targets and weights, and their edges are numbered after the nedges of the file: edge
+nedges + j has the weight weights[j].*/
+typedef struct {
+    const uint8_t* marks[2];
+    const NodeIndex* nodes[2];
+    const uint64_t* offsets[2];
+    unsigned long count[2];
+    const NodeIndex* targets;
+    const double* weights;
+} GraphPatch;
+
+//A mapped graph. All the arrays point inside the mapping and are read only.
+typedef struct {
+    unsigned long nnodes;
+    unsigned long nedges;
+    const uint64_t* ids;
+    const GraphCoord* coords;
+    const uint64_t* offsets;    //NULL when the adjacency is packed, as the targets and their reverse
+    const NodeIndex* targets;
+    const GraphBlock* blocks;   //NULL when the adjacency is plain, as the packed lists and their reverse
+    const uint8_t* packed;
+    unsigned long max_degree;
+    const uint64_t* name_offsets;
+    const char* names;
+    const void* weights;        //Metric 0 (length in km)
+    int weight_encoding;
+    double weight_unit;         //1/scale for WEIGHT_FIXED
+    IdIndex idindex;
+    const uint64_t* rev_offsets;
+    const NodeIndex* rev_sources;
+    const GraphBlock* rev_blocks;
+    const uint8_t* rev_packed;
+    const void* rev_weights;
+    const UnitVec* unitvecs;
+    GraphGrid grid;
+    const uint32_t* grid_cells;
+    const NodeIndex* grid_nodes;
+    const GraphPatch* patch;    //NULL for the graph of the file
+    void* map;
+    size_t maplen;
+} Graph;
+
+//Writer used by the converter: sections are appended one after the other and the header is written on close.
+typedef struct {
+    FILE* f;
+    uint64_t pos;
+    uint64_t hash;              //Of the sections written so far
+    GraphHeader hdr;
+} GraphWriter;
+
+
+void ExitError(const char *miss, int errcode);
+
+const char* graph_open(Graph* g, const char* path);
+void graph_close(Graph* g);
+unsigned long graph_unpack(const Graph* g, bool backward, unsigned long i, NodeIndex* buf, unsigned long* first);
+unsigned long graph_patched(const Graph* g, bool backward, unsigned long i, const NodeIndex** targets, unsigned long* first);
+double graph_round_weight(const Graph* g, double km);
+uint64_t graph_stamp(const Graph* g);
+void graph_sidecar_path(const char* binfile, const char* ext, char* path, size_t len);
+
+void graph_writer_open(GraphWriter* gw, const char* path, uint64_t nnodes, uint64_t nedges);
+void graph_write_section(GraphWriter* gw, int kind, const void* data, uint64_t size);
+void graph_write_weights(GraphWriter* gw, int kind, const double* weights, int encoding, double scale);
+void graph_write_metric(GraphWriter* gw, int metric, int kind, const double* weights, int fixed_digits);
+void graph_write_adjacency(GraphWriter* gw, bool backward, const uint64_t* offsets, const NodeIndex* targets, bool packed);
+void graph_writer_close(GraphWriter* gw);
+
+double haversine (Coord u, Coord v);
+
+static inline Coord graph_coord_of(GraphCoord c) {
+    Coord d = {c.lat / GRAPH_COORD_SCALE, c.lon / GRAPH_COORD_SCALE};
+    return d;
+}
+static inline Coord graph_coord(const Graph* g, unsigned long i) { return graph_coord_of(g->coords[i]); }
+//Great-circle distance in km between two nodes, as haversine() on their coordinates.
+static inline double graph_arc(const Graph* g, unsigned long u, unsigned long v) { return geo_arc(g->unitvecs[u], g->unitvecs[v]); }
+/*Successors of node i, or its predecessors with backward: returns how many there are, points
+*targets at them and stores the index of the edge to the first one, so that the k-th has the weight
+of edge first + k. A packed adjacency is decoded into buf, which must hold g->max_degree nodes; a
+plain one and the lists of a patch are read in place.*/
+static inline unsigned long graph_adjacent(const Graph* g, bool backward, unsigned long i, NodeIndex* buf, const NodeIndex** targets, unsigned long* first) {
+    if (g->patch != NULL && (g->patch->marks[backward][i >> 3] >> (i & 7) & 1)) return graph_patched(g, backward, i, targets, first);
+    if (g->blocks != NULL) {
+        *targets = buf;
+        return graph_unpack(g, backward, i, buf, first);
+    }
+    const uint64_t* offsets = backward ? g->rev_offsets : g->offsets;
+    *first = offsets[i];
+    *targets = (backward ? g->rev_sources : g->targets) + offsets[i];
+    return offsets[i+1] - offsets[i];
+}
+static inline double graph_weight_of(const Graph* g, const void* weights, unsigned long e) {
+    if (e >= g->nedges) return g->patch->weights[e - g->nedges];
+    if (g->weight_encoding == WEIGHT_FIXED) return ((const uint32_t*)weights)[e] * g->weight_unit;
+    return ((const float*)weights)[e];
+}
+static inline double graph_weight(const Graph* g, unsigned long e) { return graph_weight_of(g, g->weights, e); }
+static inline double graph_rev_weight(const Graph* g, unsigned long e) { return graph_weight_of(g, g->rev_weights, e); }
+static inline const char* graph_name(const Graph* g, unsigned long i, unsigned long* len) {
+    *len = g->name_offsets[i+1] - g->name_offsets[i];
+    return g->names + g->name_offsets[i];
+}
+
+#endif
@@ -0,0 +1,165 @@
+#include <stdlib.h>
+#include <math.h>
+#include "grid.h"
+
+#define DEG     (GEO_PI / 180)      //Degrees to radians, as geo_unitvec() converts them
+
+
+//Row or column of a coordinate, clamped to the grid.
+static inline unsigned long grid_slot(double x, double x0, double step, uint32_t n) {
+    double k = floor((x - x0) / step);
+    if (!(k > 0)) return 0;
+    if (k >= n) return n - 1;
+    return (unsigned long)k;
+}
+
+static inline unsigned long grid_cell(const GraphGrid* grid, Coord c) {
+    return grid_slot(c.lat, grid->lat0, grid->dlat, grid->rows) * grid->cols + grid_slot(c.lon, grid->lon0, grid->dlon, grid->cols);
+}
+
+
+/*Builds the grid of the nodes: its size in grid, and the cells and nodes arrays of SEC_GRID_CELLS
+and SEC_GRID_NODES (allocated here). Inside a cell the nodes keep their index order.*/
+void grid_build(const GraphCoord* coords, const uint64_t* offsets, unsigned long nnodes, GraphGrid* grid, uint32_t** cells, NodeIndex** nodes) {
+    unsigned long i, c;
+    double lat_min = INFINITY, lat_max = -INFINITY, lon_min = INFINITY, lon_max = -INFINITY;
+    for (i = 0; i < nnodes; i++) {
+        Coord p = graph_coord_of(coords[i]);
+        if (p.lat < lat_min) lat_min = p.lat;
+        if (p.lat > lat_max) lat_max = p.lat;
+        if (p.lon < lon_min) lon_min = p.lon;
+        if (p.lon > lon_max) lon_max = p.lon;
+    }
+    double stretch = cos((lat_min + lat_max) / 2 * DEG);
+    if (stretch < 0.01) stretch = 0.01;
+    double height = lat_max - lat_min, width = (lon_max - lon_min) * stretch;
+    double ncells = (nnodes > GRID_NODES_PER_CELL) ? (double)(nnodes / GRID_NODES_PER_CELL) : 1;
+    //A side that gives about ncells cells, but never more than ncells cells along one direction:
+    double side = sqrt(height * width / ncells);
+    if (side < height / ncells) side = height / ncells;
+    if (side < width / ncells) side = width / ncells;
+    if (!(side > 0)) side = 1;                  //A single point
+    grid->lat0 = lat_min;
+    grid->lon0 = lon_min;
+    grid->dlat = side;
+    grid->dlon = side / stretch;
+    grid->rows = (uint32_t)(height / side) + 1;
+    grid->cols = (uint32_t)(width / side) + 1;
+
+    unsigned long n = (unsigned long)grid->rows * grid->cols;
+    uint32_t *start, *cursor;
+    if ((start = (uint32_t*) calloc(2*n + 1, sizeof(uint32_t))) == NULL ||
+        (cursor = (uint32_t*) malloc(2*n*sizeof(uint32_t))) == NULL ||
+        (*nodes = (NodeIndex*) malloc((nnodes ? nnodes : 1)*sizeof(NodeIndex))) == NULL)
+            ExitError("when allocating memory for the spatial grid", 5);
+    //Counts of routable and other nodes per cell, then their first slots.
+    for (i = 0; i < nnodes; i++) start[2*grid_cell(grid, graph_coord_of(coords[i])) + (offsets[i+1] == offsets[i])] += 1;
+    uint32_t pos = 0, routable, others;
+    for (c = 0; c < n; c++) {
+        routable = start[2*c];
+        others = start[2*c+1];
+        start[2*c] = cursor[2*c] = pos;
+        start[2*c+1] = cursor[2*c+1] = pos + routable;
+        pos += routable + others;
+    }
+    start[2*n] = pos;
+    for (i = 0; i < nnodes; i++) (*nodes)[cursor[2*grid_cell(grid, graph_coord_of(coords[i])) + (offsets[i+1] == offsets[i])]++] = (NodeIndex)i;
+    free(cursor);
+    *cells = start;
+}
+
+
+//Angular distance from a point at latitude lat to the ones dlon degrees or more east or west of it.
+static inline double meridian_bound(double coslat, double dlon) {
+    if (dlon <= 0) return dlon;
+    return asin(coslat * sin((dlon < 90) ? dlon * DEG : GEO_PI / 2));
+}
+
+/*Whether node v, at slot k of a cell, has a successor in a patched graph: the cell only tells for
+the nodes whose list the patch leaves as in the file.*/
+static inline bool patched_routable(const Graph* g, unsigned long v, long k, const uint32_t* cell) {
+    const NodeIndex* targets;
+    unsigned long first;
+    if (g->patch->marks[0][v >> 3] >> (v & 7) & 1) return graph_patched(g, false, v, &targets, &first) > 0;
+    return k < (long)cell[1];
+}
+
+/*Nearest node to (lat, lon), or with routable the nearest node with a successor. Returns its index
+and stores its great-circle distance in km (if km is not NULL), or returns nnodes if there is none.
+On a patched graph (overlay.h) the successors are the patched ones, so the other nodes of every
+cell are read too.*/
+unsigned long grid_snap(const Graph* g, double lat, double lon, bool routable, double* km) {
+    const GraphGrid* grid = &g->grid;
+    UnitVec q = geo_unitvec(lat, lon);
+    long row = (long)grid_slot(lat, grid->lat0, grid->dlat, grid->rows), col = (long)grid_slot(lon, grid->lon0, grid->dlon, grid->cols);
+    long rows = grid->rows, cols = grid->cols, r, x, y, k;
+    double coslat = cos(lat * DEG), best_c2 = INFINITY, arc = INFINITY;
+    unsigned long best = g->nnodes;
+    for (r = 0; ; r++) {
+        long r0 = row - r, r1 = row + r, c0 = col - r, c1 = col + r;
+        for (y = (r0 > 0) ? r0 : 0; y <= r1 && y < rows; y++) {
+            //The whole first and last rows of the ring, only its two ends in between
+            long step = (y == r0 || y == r1) ? 1 : c1 - c0;
+            for (x = c0; x <= c1; x += step) {
+                if (x < 0 || x >= cols) continue;
+                const uint32_t* cell = g->grid_cells + 2*(y*cols + x);
+                long end = (routable && g->patch == NULL) ? cell[1] : cell[2];
+                for (k = cell[0]; k < end; k++) {
+                    unsigned long v = g->grid_nodes[k];
+                    if (routable && g->patch != NULL && !patched_routable(g, v, k, cell)) continue;
+                    const UnitVec* u = &g->unitvecs[v];
+                    double dx = u->x - q.x, dy = u->y - q.y, dz = u->z - q.z, c2 = dx*dx + dy*dy + dz*dz;
+                    if (c2 < best_c2 || (c2 == best_c2 && v < best)) {
+                        best_c2 = c2;
+                        best = v;
+                    }
+                }
+            }
+        }
+        if (r0 <= 0 && r1 >= rows - 1 && c0 <= 0 && c1 >= cols - 1) break;
+        if (best == g->nnodes) continue;
+        double half = 0.5 * sqrt(best_c2), bound = INFINITY, b;
+        arc = 2 * geo_asin(half < 1 ? half : 1);
+        if (r0 > 0 && (b = (lat - (grid->lat0 + r0*grid->dlat)) * DEG) < bound) bound = b;
+        if (r1 < rows - 1 && (b = (grid->lat0 + (r1+1)*grid->dlat - lat) * DEG) < bound) bound = b;
+        if (c0 > 0 && (b = meridian_bound(coslat, lon - (grid->lon0 + c0*grid->dlon))) < bound) bound = b;
+        if (c1 < cols - 1 && (b = meridian_bound(coslat, grid->lon0 + (c1+1)*grid->dlon - lon)) < bound) bound = b;
+        if (arc <= bound - GEO_SLACK / GEO_EARTH_RADIUS) break;
+    }
+    if (best < g->nnodes) {
+        double half = 0.5 * sqrt(best_c2);
+        arc = 2 * geo_asin(half < 1 ? half : 1);
+    }
+    if (km != NULL) *km = (best < g->nnodes) ? arc * GEO_EARTH_RADIUS : INFINITY;
+    return best;
+}
+
+
+typedef struct {
+    unsigned long cell, index;
+} SnapOrder;
+
+static int compare_snap(const void* a, const void* b) {
+    const SnapOrder *x = (const SnapOrder*)a, *y = (const SnapOrder*)b;
+    if (x->cell != y->cell) return (x->cell > y->cell) - (x->cell < y->cell);
+    return (x->index > y->index) - (x->index < y->index);
+}
+
+/*Snaps n points, as grid_snap(), into nodes[] and km[] (km can be NULL). The points are taken in
+the order of their cells, so that the cells and nodes shared by neighbouring points are read while
+they are still in cache.*/
+void grid_snap_batch(const Graph* g, const Coord* points, unsigned long n, bool routable, unsigned long* nodes, double* km) {
+    unsigned long i;
+    SnapOrder* order;
+    if ((order = (SnapOrder*) malloc((n ? n : 1)*sizeof(SnapOrder))) == NULL) ExitError("when allocating memory for the points", 5);
+    for (i = 0; i < n; i++) {
+        order[i].cell = grid_cell(&g->grid, points[i]);
+        order[i].index = i;
+    }
+    qsort(order, n, sizeof(SnapOrder), compare_snap);
+    for (i = 0; i < n; i++) {
+        unsigned long p = order[i].index;
+        nodes[p] = grid_snap(g, points[p].lat, points[p].lon, routable, (km != NULL) ? &km[p] : NULL);
+    }
+    free(order);
+}
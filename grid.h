@@ -0,0 +1,31 @@
+#ifndef GRID_H
+#define GRID_H
+
+#include <stdbool.h>
+#include "graph.h"
+
+/*Spatial index of the nodes, to snap a coordinate to its nearest node. The converter builds it and
+stores it in the .bin file (GraphGrid in the header, SEC_GRID_CELLS and SEC_GRID_NODES).
+
+The bounding box of the nodes is cut into a uniform grid of about GRID_NODES_PER_CELL nodes per
+cell. The cells are dlat x dlon degrees, with dlon stretched by 1/cos of the middle latitude so
+that they are about square on the ground. The nodes of cell c = row*cols + col are
+nodes[cells[2c] .. cells[2c+2]-1], the routable ones (with at least one successor) first, up to
+cells[2c+1], so both lookups read one contiguous range per cell.
+
+A lookup scans the cell of the point and then rings of cells around it, and stops as soon as no
+cell outside the scanned square can hold a closer node: the great-circle distance to a point out
+of the square is at least the distance to the nearest parallel or meridian of its border. The
+nodes are compared by the chord between their unit vectors, so the result is the node with the
+smallest great-circle distance, and a point has usually been snapped after a couple of rings.
+
+The grid is the one of the file. On a graph with the patch of an update log, the routable nodes are
+the ones with a patched successor, which the lookup checks node by node instead.*/
+
+#define GRID_NODES_PER_CELL     2
+
+void grid_build(const GraphCoord* coords, const uint64_t* offsets, unsigned long nnodes, GraphGrid* grid, uint32_t** cells, NodeIndex** nodes);
+unsigned long grid_snap(const Graph* g, double lat, double lon, bool routable, double* km);
+void grid_snap_batch(const Graph* g, const Coord* points, unsigned long n, bool routable, unsigned long* nodes, double* km);
+
+#endif
@@ -0,0 +1,88 @@
+#include <stdlib.h>
+#include "heap.h"
+
+
+void heap_init(OpenHeap* heap, unsigned long capacity, uint32_t* pos) {
+    if (capacity < 16) capacity = 16;
+    if ((heap->items = (HeapItem*) malloc(capacity*sizeof(HeapItem))) == NULL) ExitError("when allocating memory for the OPEN heap", 20);
+    heap->size = 0;
+    heap->capacity = capacity;
+    heap->pos = pos;
+    heap->peak = heap->decreases = 0;
+}
+
+void heap_free(OpenHeap* heap) {
+    free(heap->items);
+    heap->items = NULL;
+    heap->size = heap->capacity = 0;
+}
+
+
+//Moves the item at slot i towards the root until its parent has a smaller or equal priority.
+static void sift_up(OpenHeap* heap, unsigned long i) {
+    HeapItem item = heap->items[i];
+    while (i > 0) {
+        unsigned long parent = (i - 1) / 2;
+        if (heap->items[parent].f <= item.f) break;
+        heap->items[i] = heap->items[parent];
+        heap->pos[heap->items[i].index] = (uint32_t)i;
+        i = parent;
+    }
+    heap->items[i] = item;
+    heap->pos[item.index] = (uint32_t)i;
+}
+
+//Moves the item at slot i towards the leaves until both children have a larger or equal priority.
+static void sift_down(OpenHeap* heap, unsigned long i) {
+    HeapItem item = heap->items[i];
+    unsigned long child;
+    while ((child = 2*i + 1) < heap->size) {
+        if (child + 1 < heap->size && heap->items[child + 1].f < heap->items[child].f) child += 1;
+        if (item.f <= heap->items[child].f) break;
+        heap->items[i] = heap->items[child];
+        heap->pos[heap->items[i].index] = (uint32_t)i;
+        i = child;
+    }
+    heap->items[i] = item;
+    heap->pos[item.index] = (uint32_t)i;
+}
+
+
+void heap_push(OpenHeap* heap, unsigned long index, double f) {
+    if (heap->size == heap->capacity) {
+        HeapItem* items;
+        if ((items = (HeapItem*) realloc(heap->items, 2*heap->capacity*sizeof(HeapItem))) == NULL) ExitError("when growing the OPEN heap", 21);
+        heap->items = items;
+        heap->capacity *= 2;
+    }
+    heap->items[heap->size].f = f;
+    heap->items[heap->size].index = index;
+    heap->size += 1;
+    if (heap->size > heap->peak) heap->peak = heap->size;
+    sift_up(heap, heap->size - 1);
+}
+
+//Removes and returns the index of the node with least f. The heap must not be empty.
+unsigned long heap_pop(OpenHeap* heap) {
+    unsigned long top = heap->items[0].index;
+    heap->size -= 1;
+    if (heap->size > 0) {
+        heap->items[0] = heap->items[heap->size];
+        sift_down(heap, 0);
+    }
+    return top;
+}
+
+//Restores the heap order after the priorities of the items were changed in place.
+void heap_heapify(OpenHeap* heap) {
+    unsigned long i = heap->size / 2;
+    while (i-- > 0) sift_down(heap, i);
+}
+
+//Lowers the priority of a node that is already in the heap.
+void heap_decrease(OpenHeap* heap, unsigned long index, double f) {
+    unsigned long i = heap->pos[index];
+    heap->decreases += 1;
+    heap->items[i].f = f;
+    sift_up(heap, i);
+}
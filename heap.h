@@ -0,0 +1,42 @@
+#ifndef HEAP_H
+#define HEAP_H
+
+#include <stdint.h>
+
+/*Indexed binary min-heap used as the OPEN set of the A* search.
+Every node that is in the heap has its slot stored in pos[index], so that a node
+already in OPEN can get its priority lowered (decrease-key) in O(log n) without
+searching for it. Positions are 32-bit, like the node indices of the graph.*/
+
+//Entry of the heap: the node's index and its priority f = g + h.
+typedef struct {
+    double f;
+    unsigned long index;
+} HeapItem;
+
+typedef struct {
+    HeapItem* items;
+    unsigned long size;
+    unsigned long capacity;
+    //Position index, one entry per node of the graph (only meaningful while the node is in the heap):
+    uint32_t* pos;
+    //Statistics since the last heap_reset():
+    unsigned long peak;         //Largest size
+    unsigned long decreases;    //heap_decrease() calls
+} OpenHeap;
+
+
+void ExitError(const char *miss, int errcode);
+
+void heap_init(OpenHeap* heap, unsigned long capacity, uint32_t* pos);
+void heap_free(OpenHeap* heap);
+void heap_push(OpenHeap* heap, unsigned long index, double f);
+unsigned long heap_pop(OpenHeap* heap);
+void heap_decrease(OpenHeap* heap, unsigned long index, double f);
+void heap_heapify(OpenHeap* heap);
+
+static inline void heap_reset(OpenHeap* heap) { heap->size = heap->peak = heap->decreases = 0; }
+static inline int heap_empty(const OpenHeap* heap) { return heap->size == 0; }
+static inline double heap_min(const OpenHeap* heap) { return heap->items[0].f; }
+
+#endif
@@ -0,0 +1,34 @@
+#include "idindex.h"
+
+
+//Number of slots for nnodes nodes: a power of 2, at least twice the number of nodes.
+uint64_t idindex_nslots(uint64_t nnodes) {
+    uint64_t nslots = 16;
+    while (nslots < 2*nnodes) nslots *= 2;
+    return nslots;
+}
+
+void idindex_init(IdIndex* ix, const uint32_t* slots, uint64_t nslots, const uint64_t* ids) {
+    int bits = 0;
+    while (((uint64_t)1 << bits) < nslots) bits += 1;
+    ix->slots = slots;
+    ix->ids = ids;
+    ix->mask = nslots - 1;
+    ix->region_mask = (bits < IDINDEX_REGION_BITS) ? nslots - 1 : ((uint64_t)1 << IDINDEX_REGION_BITS) - 1;
+    ix->shift = 64 - bits;
+}
+
+/*Inserts a node in the (writable) slots of the table. A node whose id is already in the table is
+not inserted again, so the first node with a given id is the one that is found.*/
+void idindex_insert(const IdIndex* ix, uint32_t* slots, uint64_t index) {
+    uint64_t id = ix->ids[index];
+    uint64_t k = idindex_home(ix, id);
+    uint64_t base = k & ~ix->region_mask;
+    uint64_t probes = 0;
+    while (slots[k] != IDINDEX_EMPTY) {
+        if (ix->ids[slots[k]-1] == id) return;
+        if (++probes >= ix->region_mask) ExitError("a region of the id index is full", 15);
+        k = base | ((k + 1) & ix->region_mask);
+    }
+    slots[k] = (uint32_t)(index + 1);
+}
@@ -0,0 +1,55 @@
+#ifndef IDINDEX_H
+#define IDINDEX_H
+
+#include <stdint.h>
+
+/*Open-addressing hash table from OSM id to node index. It replaces the binary searches over the
+node array: the converter uses it to resolve the node ids of the ways and the router stores it in
+the .bin file (SEC_IDINDEX) to resolve the query ids.
+
+The slots hold index+1 (0 is an empty slot) and the keys are read from the ids array, so the
+table costs 4 bytes per slot (NodeIndex) with at least two slots per node. The table is split into regions
+of IDINDEX_REGION slots and probing wraps around inside the region of the home slot. Regions are
+independent, so the converter fills them in parallel, and as every region is filled in node order
+the table is the same whatever the number of threads.*/
+
+#define IDINDEX_REGION_BITS 16
+#define IDINDEX_EMPTY 0
+
+typedef struct {
+    const uint32_t* slots;
+    const uint64_t* ids;
+    uint64_t mask;              //nslots - 1 (nslots is a power of 2)
+    uint64_t region_mask;       //Region size - 1
+    int shift;                  //64 - log2(nslots)
+} IdIndex;
+
+
+void ExitError(const char *miss, int errcode);
+
+uint64_t idindex_nslots(uint64_t nnodes);
+void idindex_init(IdIndex* ix, const uint32_t* slots, uint64_t nslots, const uint64_t* ids);
+void idindex_insert(const IdIndex* ix, uint32_t* slots, uint64_t index);
+
+//Fibonacci hashing: the top bits of id * 2^64/phi give the home slot.
+static inline uint64_t idindex_home(const IdIndex* ix, uint64_t id) {
+    return (id * 0x9E3779B97F4A7C15ULL) >> ix->shift;
+}
+
+static inline uint64_t idindex_region(const IdIndex* ix, uint64_t id) {
+    return idindex_home(ix, id) >> IDINDEX_REGION_BITS;
+}
+
+//Returns the index of the node with that id, or -1 if it is not in the graph.
+static inline signed long idindex_find(const IdIndex* ix, uint64_t id) {
+    uint64_t k = idindex_home(ix, id);
+    uint64_t base = k & ~ix->region_mask;
+    uint64_t s;
+    while ((s = ix->slots[k]) != IDINDEX_EMPTY) {
+        if (ix->ids[s-1] == id) return (signed long)(s - 1);
+        k = base | ((k + 1) & ix->region_mask);
+    }
+    return -1;
+}
+
+#endif
@@ -0,0 +1,49 @@
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "landmarks.h"
+
+
+/*Maps a landmark file and checks that it belongs to the graph g. Returns NULL on success or a
+message describing why the file cannot be used.*/
+const char* landmarks_open(Landmarks* lm, const char* path, const Graph* g) {
+    int fd;
+    struct stat st;
+    if ((fd = open(path, O_RDONLY)) < 0) return "the landmark file cannot be opened";
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(AltHeader)) {
+        close(fd);
+        return "the landmark file is too small to hold a header";
+    }
+    void* map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return "the landmark file cannot be mapped";
+
+    const AltHeader* hdr = (const AltHeader*) map;
+    size_t maplen = (size_t)st.st_size;
+    const char* err = NULL;
+    if (memcmp(hdr->magic, ALT_MAGIC, sizeof(hdr->magic)) != 0) err = "the landmark file is not a landmark file (run write_alt first)";
+    else if (hdr->endian != GRAPH_ENDIAN_TAG) err = "the landmark file was written with a different byte order";
+    else if (hdr->version != ALT_VERSION) err = "the landmark file has an unsupported version (run write_alt again)";
+    else if (hdr->nnodes != g->nnodes || hdr->stamp != graph_stamp(g)) err = "the landmark file was computed for another graph (run write_alt again)";
+    else if (hdr->nlandmarks == 0 || hdr->nlandmarks > ALT_MAX || hdr->table_offset % GRAPH_ALIGN != 0 ||
+             hdr->table_offset < sizeof(AltHeader) + hdr->nlandmarks*sizeof(uint64_t) ||
+             hdr->table_offset > maplen || (maplen - hdr->table_offset) / (2*hdr->nlandmarks*sizeof(float)) < hdr->nnodes)
+        err = "the landmark file is truncated or corrupt";
+    if (err != NULL) { munmap(map, maplen); return err; }
+
+    lm->k = hdr->nlandmarks;
+    lm->nodes = (const uint64_t*)((const char*)map + sizeof(AltHeader));
+    lm->dist = (const float*)((const char*)map + hdr->table_offset);
+    lm->map = map;
+    lm->maplen = maplen;
+    return NULL;
+}
+
+void landmarks_close(Landmarks* lm) {
+    munmap(lm->map, lm->maplen);
+    lm->map = NULL;
+}
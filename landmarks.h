@@ -0,0 +1,77 @@
+#ifndef LANDMARKS_H
+#define LANDMARKS_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <math.h>
+#include "graph.h"
+
+/*ALT heuristic (A*, landmarks and triangle inequality). For a landmark L the triangle inequality
+gives two lower bounds of the distance from v to t:
+
+    d(L,t) - d(L,v) <= d(v,t)        and        d(v,L) - d(t,L) <= d(v,t)
+
+and the heuristic is the largest of them over all the landmarks (and haversine()). Unlike the
+straight line, the bounds follow the roads, so they are much tighter on a road network.
+
+The distances are computed by write_alt.c with the same edge weights the search uses and stored
+in a sidecar file next to the .bin (map.bin -> map.alt, see graph_sidecar_path()), memory mapped like the graph:
+
+    AltHeader
+    uint64_t[K]             node index of every landmark
+    float[nnodes][2K]       for every node v: d(L_k,v) for k < K, then d(v,L_k); INFINITY if there is no path
+
+The K values of a node are together so that evaluating the heuristic reads one cache line or two.
+The file costs 8K bytes per node. The stored floats are rounded, so every bound is lowered by
+ALT_SLACK times the distances it uses to stay admissible.
+
+The file records a stamp of the .bin it was computed from and is rejected if the graph changes.*/
+
+#define ALT_MAGIC       "ASTARALT"
+#define ALT_VERSION     1
+#define ALT_MAX         64
+#define ALT_SLACK       1.2e-7      //Above the relative rounding error of a float (2^-24), twice
+
+typedef struct {
+    char magic[8];
+    uint32_t endian;
+    uint32_t version;
+    uint64_t nnodes;
+    uint64_t stamp;             //graph_stamp() of the graph
+    uint32_t nlandmarks;
+    uint32_t reserved;
+    uint64_t table_offset;      //Of the distance table, GRAPH_ALIGN aligned
+} AltHeader;
+
+typedef struct {
+    unsigned int k;
+    const uint64_t* nodes;
+    const float* dist;
+    void* map;
+    size_t maplen;
+} Landmarks;
+
+
+const char* landmarks_open(Landmarks* lm, const char* path, const Graph* g);
+void landmarks_close(Landmarks* lm);
+
+//Lower bound of the distance from v to t given by the landmarks.
+static inline double landmarks_bound(const Landmarks* lm, unsigned long v, unsigned long t) {
+    const float* dv = lm->dist + v * 2 * lm->k;
+    const float* dt = lm->dist + t * 2 * lm->k;
+    double best = 0, b;
+    unsigned int i, k = lm->k;
+    for (i = 0; i < k; i++) {
+        if (dt[i] < INFINITY && dv[i] < INFINITY) {
+            b = (double)dt[i] - dv[i] - ALT_SLACK * ((double)dt[i] + dv[i]);
+            if (b > best) best = b;
+        }
+        if (dv[k+i] < INFINITY && dt[k+i] < INFINITY) {
+            b = (double)dv[k+i] - dt[k+i] - ALT_SLACK * ((double)dv[k+i] + dt[k+i]);
+            if (b > best) best = b;
+        }
+    }
+    return best;
+}
+
+#endif
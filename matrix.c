@@ -0,0 +1,249 @@
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+#include "matrix.h"
+#include "search.h"
+
+
+//A node settled by the upward search from a target, and its distance from the target.
+typedef struct {
+    NodeIndex node;
+    double d;
+} Settled;
+
+//An entry of the bucket of a node: the column of a target and the distance between both.
+typedef struct {
+    NodeIndex column;
+    double d;
+} BucketEntry;
+
+typedef struct Matrix Matrix;
+
+struct Matrix {
+    const Graph* graph;
+    const CHGraph* ch;
+    const NodeIndex *sources, *targets;
+    unsigned long nsources, ntargets;
+    double* m;
+    //One-to-many searches: the targets as a bitmap, and the text of the paths of every row
+    uint8_t* marks;
+    unsigned long ndistinct;
+    char** row_paths;
+    size_t* row_paths_len;
+    //Buckets: the upward search of every target, then the entries by node, bucket[bucket_offsets[v] .. bucket_offsets[v+1]-1]
+    Settled** settled;
+    unsigned long* nsettled;
+    unsigned long* bucket_offsets;
+    BucketEntry* bucket;
+    //Jobs of the current phase, handed out in order
+    pthread_mutex_t lock;
+    unsigned long next, njobs;
+    void (*task)(Matrix*, SearchState*, unsigned long);
+};
+
+typedef struct {
+    Matrix* mx;
+    SearchState S;
+} MatrixWorker;
+
+
+static void* matrix_worker(void* arg) {
+    Matrix* mx = ((MatrixWorker*) arg)->mx;
+    SearchState* S = &((MatrixWorker*) arg)->S;
+    while (true) {
+        pthread_mutex_lock(&mx->lock);
+        unsigned long job = mx->next++;
+        pthread_mutex_unlock(&mx->lock);
+        if (job >= mx->njobs) break;
+        mx->task(mx, S, job);
+    }
+    return NULL;
+}
+
+//Runs task on the jobs 0 .. njobs-1 with every worker and waits for them.
+static void run_phase(Matrix* mx, MatrixWorker* workers, int nworkers, unsigned long njobs, void (*task)(Matrix*, SearchState*, unsigned long)) {
+    pthread_t threads[nworkers];
+    int w;
+    mx->next = 0;
+    mx->njobs = njobs;
+    mx->task = task;
+    for (w = 0; w < nworkers; w++)
+        if (pthread_create(&threads[w], NULL, matrix_worker, &workers[w]) != 0) ExitError("when creating a worker thread", 20);
+    for (w = 0; w < nworkers; w++) pthread_join(threads[w], NULL);
+}
+
+
+//Row i without a hierarchy: one search from the source to all the targets, and their paths.
+static void one_to_many_row(Matrix* mx, SearchState* S, unsigned long i) {
+    unsigned long j, k, len, source = mx->sources[i];
+    double* row = mx->m + i*mx->ntargets;
+    OneToMany(mx->graph, S, source, mx->marks, mx->ndistinct);
+    for (j = 0; j < mx->ntargets; j++) row[j] = search_label(S, mx->targets[j], false);
+    if (mx->row_paths == NULL) return;
+    FILE* out = open_memstream(&mx->row_paths[i], &mx->row_paths_len[i]);
+    if (out == NULL) ExitError("when allocating memory for the paths", 22);
+    for (j = 0; j < mx->ntargets; j++) {
+        if (row[j] == INFINITY) continue;
+        len = tree_path(S, source, mx->targets[j]);
+        fprintf(out, "%lu %lu %.6f %lu", mx->graph->ids[source], mx->graph->ids[mx->targets[j]], S->distance*1000, len);
+        for (k = 0; k < len; k++) fprintf(out, " %lu", mx->graph->ids[S->path[k]]);
+        fputc('\n', out);
+    }
+    fclose(out);
+}
+
+//Upward search from target j, kept for the buckets.
+static void target_search(Matrix* mx, SearchState* S, unsigned long j) {
+    unsigned long k, n = CHUpward(mx->ch, S, mx->targets[j], true);
+    Settled* s;
+    if ((s = (Settled*) malloc((n ? n : 1)*sizeof(Settled))) == NULL) ExitError("when allocating memory for the buckets", 22);
+    for (k = 0; k < n; k++) {
+        s[k].node = S->closed[k];
+        s[k].d = search_label(S, S->closed[k], true);
+    }
+    mx->settled[j] = s;
+    mx->nsettled[j] = n;
+}
+
+//Row i with a hierarchy: upward search from the source, through the buckets of the nodes it settles.
+static void bucket_row(Matrix* mx, SearchState* S, unsigned long i) {
+    unsigned long j, k, e, n = CHUpward(mx->ch, S, mx->sources[i], false);
+    double* row = mx->m + i*mx->ntargets;
+    for (j = 0; j < mx->ntargets; j++) row[j] = INFINITY;
+    for (k = 0; k < n; k++) {
+        unsigned long v = S->closed[k];
+        double g = search_label(S, v, false);
+        for (e = mx->bucket_offsets[v]; e < mx->bucket_offsets[v+1]; e++)
+            if (g + mx->bucket[e].d < row[mx->bucket[e].column]) row[mx->bucket[e].column] = g + mx->bucket[e].d;
+    }
+}
+
+//Moves the upward searches of the targets into the buckets of the nodes, a counting sort by node.
+static void fill_buckets(Matrix* mx) {
+    unsigned long j, k, v, nnodes = mx->graph->nnodes, total = 0;
+    if ((mx->bucket_offsets = (unsigned long*) calloc(nnodes + 1, sizeof(unsigned long))) == NULL)
+        ExitError("when allocating memory for the buckets", 22);
+    for (j = 0; j < mx->ntargets; j++) {
+        total += mx->nsettled[j];
+        for (k = 0; k < mx->nsettled[j]; k++) mx->bucket_offsets[mx->settled[j][k].node + 1] += 1;
+    }
+    for (v = 0; v < nnodes; v++) mx->bucket_offsets[v+1] += mx->bucket_offsets[v];
+    if ((mx->bucket = (BucketEntry*) malloc((total ? total : 1)*sizeof(BucketEntry))) == NULL) ExitError("when allocating memory for the buckets", 22);
+    for (j = 0; j < mx->ntargets; j++) {
+        for (k = 0; k < mx->nsettled[j]; k++) {
+            BucketEntry* b = &mx->bucket[mx->bucket_offsets[mx->settled[j][k].node]++];
+            b->column = (NodeIndex)j;
+            b->d = mx->settled[j][k].d;
+        }
+        free(mx->settled[j]);
+    }
+    //Every offset moved to the end of its bucket: shift them back
+    for (v = nnodes; v > 0; v--) mx->bucket_offsets[v] = mx->bucket_offsets[v-1];
+    mx->bucket_offsets[0] = 0;
+}
+
+
+double* distance_matrix(const Graph* graph, const CHGraph* ch, const NodeIndex* sources, unsigned long nsources,
+                        const NodeIndex* targets, unsigned long ntargets, int nworkers, FILE* paths) {
+    Matrix mx;
+    memset(&mx, 0, sizeof(Matrix));
+    mx.graph = graph;
+    mx.ch = (paths == NULL) ? ch : NULL;
+    mx.sources = sources;
+    mx.nsources = nsources;
+    mx.targets = targets;
+    mx.ntargets = ntargets;
+    unsigned long cells = nsources*ntargets;
+    if ((mx.m = (double*) malloc((cells ? cells : 1)*sizeof(double))) == NULL)
+        ExitError("when allocating memory for the distance matrix", 22);
+    pthread_mutex_init(&mx.lock, NULL);
+    if (nworkers < 1) nworkers = 1;
+    MatrixWorker workers[nworkers];
+    int w;
+    for (w = 0; w < nworkers; w++) {
+        workers[w].mx = &mx;
+        search_init(&workers[w].S, graph->nnodes);
+    }
+
+    unsigned long i, j;
+    if (mx.ch != NULL) {
+        if ((mx.settled = (Settled**) malloc((ntargets ? ntargets : 1)*sizeof(Settled*))) == NULL ||
+            (mx.nsettled = (unsigned long*) malloc((ntargets ? ntargets : 1)*sizeof(unsigned long))) == NULL)
+                ExitError("when allocating memory for the buckets", 22);
+        run_phase(&mx, workers, nworkers, ntargets, target_search);
+        fill_buckets(&mx);
+        run_phase(&mx, workers, nworkers, nsources, bucket_row);
+        free(mx.settled);
+        free(mx.nsettled);
+        free(mx.bucket_offsets);
+        free(mx.bucket);
+    }
+    else {
+        if ((mx.marks = (uint8_t*) calloc(graph->nnodes / 8 + 1, 1)) == NULL) ExitError("when allocating memory for the targets", 22);
+        for (j = 0; j < ntargets; j++) {
+            uint8_t bit = (uint8_t)(1u << (targets[j] & 7));
+            if (!(mx.marks[targets[j] >> 3] & bit)) mx.ndistinct += 1;
+            mx.marks[targets[j] >> 3] |= bit;
+        }
+        if (paths != NULL) {
+            if ((mx.row_paths = (char**) calloc(nsources ? nsources : 1, sizeof(char*))) == NULL ||
+                (mx.row_paths_len = (size_t*) calloc(nsources ? nsources : 1, sizeof(size_t))) == NULL)
+                    ExitError("when allocating memory for the paths", 22);
+        }
+        run_phase(&mx, workers, nworkers, nsources, one_to_many_row);
+        if (paths != NULL) {
+            for (i = 0; i < nsources; i++) {
+                fwrite(mx.row_paths[i], 1, mx.row_paths_len[i], paths);
+                free(mx.row_paths[i]);
+            }
+            free(mx.row_paths);
+            free(mx.row_paths_len);
+        }
+        free(mx.marks);
+    }
+
+    for (w = 0; w < nworkers; w++) search_free(&workers[w].S);
+    pthread_mutex_destroy(&mx.lock);
+    return mx.m;
+}
+
+
+//The table as csv: a header line with the target ids, then a line per source with its id and the distances in meters (empty without a path).
+void write_matrix_csv(FILE* out, const Graph* graph, const double* m, const NodeIndex* sources, unsigned long nsources,
+                      const NodeIndex* targets, unsigned long ntargets) {
+    unsigned long i, j;
+    fprintf(out, "source");
+    for (j = 0; j < ntargets; j++) fprintf(out, ",%lu", graph->ids[targets[j]]);
+    fputc('\n', out);
+    for (i = 0; i < nsources; i++) {
+        fprintf(out, "%lu", graph->ids[sources[i]]);
+        for (j = 0; j < ntargets; j++) {
+            double d = m[i*ntargets + j];
+            if (d == INFINITY) fputc(',', out);
+            else fprintf(out, ",%.6f", d*1000);
+        }
+        fputc('\n', out);
+    }
+    if (fflush(out) != 0) ExitError("when writing the distance matrix", 23);
+}
+
+void write_matrix_bin(FILE* out, const Graph* graph, const double* m, const NodeIndex* sources, unsigned long nsources,
+                      const NodeIndex* targets, unsigned long ntargets) {
+    MatrixHeader hdr;
+    memset(&hdr, 0, sizeof(MatrixHeader));
+    memcpy(hdr.magic, MATRIX_MAGIC, sizeof(hdr.magic));
+    hdr.endian = GRAPH_ENDIAN_TAG;
+    hdr.version = MATRIX_VERSION;
+    hdr.nsources = nsources;
+    hdr.ntargets = ntargets;
+    bool ok = fwrite(&hdr, sizeof(MatrixHeader), 1, out) == 1;
+    unsigned long i;
+    for (i = 0; ok && i < nsources; i++) ok = fwrite(&graph->ids[sources[i]], sizeof(uint64_t), 1, out) == 1;
+    for (i = 0; ok && i < ntargets; i++) ok = fwrite(&graph->ids[targets[i]], sizeof(uint64_t), 1, out) == 1;
+    for (i = 0; ok && i < nsources*ntargets; i++) {
+        double meters = m[i]*1000;
+        ok = fwrite(&meters, sizeof(double), 1, out) == 1;
+    }
+    if (!ok || fflush(out) != 0) ExitError("when writing the distance matrix", 23);
+}
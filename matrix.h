@@ -0,0 +1,50 @@
+#ifndef MATRIX_H
+#define MATRIX_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include "graph.h"
+#include "ch.h"
+
+/*Distance tables: the shortest distance from every node of a list of sources to every node of a
+list of targets, for dispatching, which needs the whole table rather than single paths.
+
+Without a hierarchy every source gets one Dijkstra search (OneToMany) that stops as soon as all the
+targets are settled, instead of one A* per pair. With a hierarchy the table is made with buckets
+(Knopp et al., 2007): an upward search from every target leaves (target, distance) in a bucket at
+every node it settles, then an upward search from every source reads the buckets of the nodes it
+settles, and a cell is the smallest sum found. That is nsources + ntargets small searches for the
+whole table.
+
+The searches run on nworkers threads, each one with its own SearchState on the shared graph. The
+table is dense and row-major, in km, with INFINITY where there is no path. With paths != NULL the
+path of every cell is also written, one line "source_id dest_id meters n ids..." per reachable
+cell in row order. The paths come from the search trees, so they are always computed without the
+hierarchy.
+
+The binary table written by write_matrix_bin():
+
+    MatrixHeader
+    uint64_t source_ids[nsources]
+    uint64_t target_ids[ntargets]
+    double   meters[nsources][ntargets]     INFINITY where there is no path*/
+
+#define MATRIX_MAGIC    "ASTARMTX"
+#define MATRIX_VERSION  1
+
+typedef struct {
+    char magic[8];
+    uint32_t endian;            //GRAPH_ENDIAN_TAG
+    uint32_t version;
+    uint64_t nsources, ntargets;
+} MatrixHeader;
+
+
+double* distance_matrix(const Graph* graph, const CHGraph* ch, const NodeIndex* sources, unsigned long nsources,
+                        const NodeIndex* targets, unsigned long ntargets, int nworkers, FILE* paths);
+void write_matrix_csv(FILE* out, const Graph* graph, const double* m, const NodeIndex* sources, unsigned long nsources,
+                      const NodeIndex* targets, unsigned long ntargets);
+void write_matrix_bin(FILE* out, const Graph* graph, const double* m, const NodeIndex* sources, unsigned long nsources,
+                      const NodeIndex* targets, unsigned long ntargets);
+
+#endif
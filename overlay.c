@@ -0,0 +1,352 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <sys/stat.h>
+#include "overlay.h"
+
+
+//An edge of a changed list: the node of the list, the other end, its position and its length.
+typedef struct {
+    NodeIndex node, other;
+    unsigned long seq;
+    double w;
+} PatchEdge;
+
+//An update with its line order, to group the updates by node.
+typedef struct {
+    GraphUpdate u;
+    unsigned long seq;
+} OrderedUpdate;
+
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+//Doubles the capacity of a growable array when it is full.
+static void* grow(void* array, unsigned long count, unsigned long* cap, size_t elemsize) {
+    if (count < *cap) return array;
+    *cap = (*cap) ? 2*(*cap) : 1024;
+    if ((array = realloc(array, (*cap)*elemsize)) == NULL) ExitError("when allocating memory for the graph updates", 24);
+    return array;
+}
+
+static int compare_update(const void* a, const void* b) {
+    const OrderedUpdate *x = (const OrderedUpdate*)a, *y = (const OrderedUpdate*)b;
+    if (x->u.from != y->u.from) return (x->u.from > y->u.from) - (x->u.from < y->u.from);
+    return (x->seq > y->seq) - (x->seq < y->seq);
+}
+
+static int compare_patch_edge(const void* a, const void* b) {
+    const PatchEdge *x = (const PatchEdge*)a, *y = (const PatchEdge*)b;
+    if (x->node != y->node) return (x->node > y->node) - (x->node < y->node);
+    if (x->other != y->other) return (x->other > y->other) - (x->other < y->other);
+    return (x->seq > y->seq) - (x->seq < y->seq);
+}
+
+static int compare_node(const void* a, const void* b) {
+    NodeIndex x = *(const NodeIndex*)a, y = *(const NodeIndex*)b;
+    return (x > y) - (x < y);
+}
+
+
+/*Parses a line of the update log. Returns 1 and fills u for an update, 0 for an empty line or a
+comment, and -1 if the line is not a valid update of this graph.*/
+int overlay_parse(const Graph* base, const char* line, GraphUpdate* u) {
+    char word[16], extra;
+    unsigned long from, to;
+    double meters = NAN;
+    line += strspn(line, " \t");
+    if (*line == '#' || *line == '\n' || *line == '\r' || *line == '\0') return 0;
+    int n = sscanf(line, "%15s %lu %lu %lf %c", word, &from, &to, &meters, &extra);
+    if (n == 3 && strcmp(word, "remove") == 0) u->kind = UPDATE_REMOVE;
+    else if ((n == 3 || n == 4) && strcmp(word, "add") == 0) u->kind = UPDATE_ADD;
+    else if (n == 4 && strcmp(word, "weight") == 0) u->kind = UPDATE_WEIGHT;
+    else return -1;
+    if (n == 4 && !(meters >= 0 && meters < INFINITY)) return -1;
+    signed long a = idindex_find(&base->idindex, from), b = idindex_find(&base->idindex, to);
+    if (a < 0 || b < 0 || a == b) return -1;
+    u->from = (NodeIndex)a;
+    u->to = (NodeIndex)b;
+    //Never below the great-circle distance, computed as the converter does
+    double arc = haversine(graph_coord(base, a), graph_coord(base, b));
+    double km = (n == 4) ? meters / 1000 : arc;
+    u->km = graph_round_weight(base, (km > arc) ? km : arc);
+    return 1;
+}
+
+
+/*Builds the snapshot of the first n updates: the new successor list of every node that is the
+source of an update, and the new predecessor list of every node that was or is now a successor of
+one of them. The other nodes keep the lists of the file.*/
+OverlaySnapshot* overlay_build(const Graph* base, const GraphUpdate* updates, unsigned long n) {
+    OverlaySnapshot* snap;
+    if ((snap = (OverlaySnapshot*) calloc(1, sizeof(OverlaySnapshot))) == NULL) ExitError("when allocating memory for the graph updates", 24);
+    snap->graph = *base;
+    snap->graph.patch = NULL;
+    snap->nupdates = n;
+    if (n == 0) return snap;
+
+    unsigned long i, k, m, len, first, nfwd = 0, capfwd = 0, nrev = 0, caprev = 0, ntouched = 0, captouched = 0;
+    const NodeIndex* targets;
+    NodeIndex *buf = NULL, *touched = NULL;
+    PatchEdge *fwd = NULL, *rev = NULL;
+    OrderedUpdate* order;
+    NodeIndex* fwd_nodes = NULL;
+    uint64_t* fwd_starts = NULL;
+    unsigned long bitmap = base->nnodes / 8 + 1;
+    if ((order = (OrderedUpdate*) malloc(n*sizeof(OrderedUpdate))) == NULL ||
+        (fwd_nodes = (NodeIndex*) malloc(n*sizeof(NodeIndex))) == NULL ||
+        (fwd_starts = (uint64_t*) malloc(n*sizeof(uint64_t))) == NULL ||
+        (buf = (NodeIndex*) malloc((base->max_degree + 1)*sizeof(NodeIndex))) == NULL ||
+        (snap->marks = (uint8_t*) calloc(2*bitmap, 1)) == NULL)
+            ExitError("when allocating memory for the graph updates", 24);
+    for (i = 0; i < n; i++) {
+        order[i].u = updates[i];
+        order[i].seq = i;
+    }
+    qsort(order, n, sizeof(OrderedUpdate), compare_update);
+
+    //The successors: the list of the file, then the updates of the node in the order of the log.
+    unsigned long nfwd_nodes = 0;
+    for (i = 0; i < n; i = k) {
+        NodeIndex u = order[i].u.from;
+        unsigned long start = nfwd;
+        fwd_nodes[nfwd_nodes] = u;
+        fwd_starts[nfwd_nodes++] = start;
+        snap->marks[u >> 3] |= (uint8_t)(1u << (u & 7));
+        len = graph_adjacent(base, false, u, buf, &targets, &first);
+        for (m = 0; m < len; m++) {
+            fwd = (PatchEdge*) grow(fwd, nfwd, &capfwd, sizeof(PatchEdge));
+            fwd[nfwd].node = u;
+            fwd[nfwd].other = targets[m];
+            fwd[nfwd++].w = graph_weight(base, first + m);
+            touched = (NodeIndex*) grow(touched, ntouched, &captouched, sizeof(NodeIndex));
+            touched[ntouched++] = targets[m];
+        }
+        for (k = i; k < n && order[k].u.from == u; k++) {
+            const GraphUpdate* up = &order[k].u;
+            if (up->kind == UPDATE_ADD) {
+                fwd = (PatchEdge*) grow(fwd, nfwd, &capfwd, sizeof(PatchEdge));
+                fwd[nfwd].node = u;
+                fwd[nfwd].other = up->to;
+                fwd[nfwd++].w = up->km;
+                touched = (NodeIndex*) grow(touched, ntouched, &captouched, sizeof(NodeIndex));
+                touched[ntouched++] = up->to;
+                snap->shorter = true;
+            }
+            else if (up->kind == UPDATE_WEIGHT) {
+                for (m = start; m < nfwd; m++) {
+                    if (fwd[m].other != up->to) continue;
+                    if (up->km < fwd[m].w) snap->shorter = true;
+                    fwd[m].w = up->km;
+                }
+            }
+            else {
+                unsigned long kept = start;
+                for (m = start; m < nfwd; m++)
+                    if (fwd[m].other != up->to) fwd[kept++] = fwd[m];
+                nfwd = kept;
+            }
+        }
+        for (m = start; m < nfwd; m++) fwd[m].seq = m - start;
+    }
+    free(order);
+
+    /*The predecessors of the touched nodes: the ones of the file from the nodes without a new list,
+    and the new successor lists turned around, by source.*/
+    uint8_t* rev_marks = snap->marks + bitmap;
+    qsort(touched, ntouched, sizeof(NodeIndex), compare_node);
+    unsigned long nrev_nodes = 0;
+    for (i = 0; i < ntouched; i++) {
+        NodeIndex v = touched[i];
+        if (nrev_nodes > 0 && touched[nrev_nodes-1] == v) continue;
+        touched[nrev_nodes++] = v;
+        rev_marks[v >> 3] |= (uint8_t)(1u << (v & 7));
+        len = graph_adjacent(base, true, v, buf, &targets, &first);
+        for (m = 0; m < len; m++) {
+            if (snap->marks[targets[m] >> 3] >> (targets[m] & 7) & 1) continue;
+            rev = (PatchEdge*) grow(rev, nrev, &caprev, sizeof(PatchEdge));
+            rev[nrev].node = v;
+            rev[nrev].other = targets[m];
+            rev[nrev].seq = m;
+            rev[nrev++].w = graph_weight_of(base, base->rev_weights, first + m);
+        }
+    }
+    for (m = 0; m < nfwd; m++) {
+        rev = (PatchEdge*) grow(rev, nrev, &caprev, sizeof(PatchEdge));
+        rev[nrev].node = fwd[m].other;
+        rev[nrev].other = fwd[m].node;
+        rev[nrev].seq = fwd[m].seq;
+        rev[nrev++].w = fwd[m].w;
+    }
+    qsort(rev, nrev, sizeof(PatchEdge), compare_patch_edge);
+
+    //Both directions one after the other, numbered from the forward lists on.
+    if ((snap->nodes = (NodeIndex*) malloc((nfwd_nodes + nrev_nodes)*sizeof(NodeIndex))) == NULL ||
+        (snap->offsets = (uint64_t*) malloc((nfwd_nodes + nrev_nodes + 2)*sizeof(uint64_t))) == NULL ||
+        (snap->targets = (NodeIndex*) malloc((nfwd + nrev + 1)*sizeof(NodeIndex))) == NULL ||
+        (snap->weights = (double*) malloc((nfwd + nrev + 1)*sizeof(double))) == NULL)
+            ExitError("when allocating memory for the graph updates", 24);
+    memcpy(snap->nodes, fwd_nodes, nfwd_nodes*sizeof(NodeIndex));
+    memcpy(snap->offsets, fwd_starts, nfwd_nodes*sizeof(uint64_t));
+    snap->offsets[nfwd_nodes] = nfwd;
+    memcpy(snap->nodes + nfwd_nodes, touched, nrev_nodes*sizeof(NodeIndex));
+    uint64_t* rev_offsets = snap->offsets + nfwd_nodes + 1;
+    for (k = 0, m = 0; k < nrev_nodes; k++) {
+        rev_offsets[k] = nfwd + m;
+        while (m < nrev && rev[m].node == touched[k]) m++;
+    }
+    rev_offsets[nrev_nodes] = nfwd + nrev;
+    for (m = 0; m < nfwd; m++) {
+        snap->targets[m] = fwd[m].other;
+        snap->weights[m] = fwd[m].w;
+    }
+    for (m = 0; m < nrev; m++) {
+        snap->targets[nfwd + m] = rev[m].other;
+        snap->weights[nfwd + m] = rev[m].w;
+    }
+    snap->patch.marks[0] = snap->marks;
+    snap->patch.marks[1] = rev_marks;
+    snap->patch.nodes[0] = snap->nodes;
+    snap->patch.nodes[1] = snap->nodes + nfwd_nodes;
+    snap->patch.offsets[0] = snap->offsets;
+    snap->patch.offsets[1] = rev_offsets;
+    snap->patch.count[0] = nfwd_nodes;
+    snap->patch.count[1] = nrev_nodes;
+    snap->patch.targets = snap->targets;
+    snap->patch.weights = snap->weights;
+    snap->graph.patch = &snap->patch;
+    free(fwd_nodes);
+    free(fwd_starts);
+    free(fwd);
+    free(rev);
+    free(touched);
+    free(buf);
+    return snap;
+}
+
+void overlay_free(OverlaySnapshot* snap) {
+    free(snap->marks);
+    free(snap->nodes);
+    free(snap->offsets);
+    free(snap->targets);
+    free(snap->weights);
+    free(snap);
+}
+
+
+//Forgets the updates read so far, to read the log again from its start.
+static void overlay_reset(Overlay* ov) {
+    ov->nupdates = ov->lines = 0;
+    ov->read = 0;
+}
+
+/*Reads the complete lines appended to the log since the last look, and the whole log again if it
+shrank or is another file, or if a marker of compact says that more of it is in the graph. Returns
+true if the updates changed.*/
+static bool overlay_read(Overlay* ov) {
+    bool changed = false;
+    struct stat st;
+    FILE* f = fopen(ov->path, "r");
+    if (f == NULL || fstat(fileno(f), &st) != 0) {
+        //No log (any more): no updates
+        if (f != NULL) fclose(f);
+        changed = ov->nupdates > 0;
+        overlay_reset(ov);
+        ov->merged = 0;
+        ov->dev = 0;
+        ov->ino = 0;
+        return changed;
+    }
+    if (st.st_dev != ov->dev || st.st_ino != ov->ino || st.st_size < ov->read) {
+        changed = ov->nupdates > 0;
+        overlay_reset(ov);
+        ov->merged = 0;
+        ov->dev = st.st_dev;
+        ov->ino = st.st_ino;
+    }
+    if (st.st_size > ov->read && fseeko(f, ov->read, SEEK_SET) == 0) {
+        char* line = NULL;
+        size_t line_cap = 0;
+        ssize_t len;
+        GraphUpdate u;
+        int r;
+        uint64_t stamp, bytes;
+        while ((len = getline(&line, &line_cap, f)) > 0 && line[len-1] == '\n') {
+            ov->read += len;
+            ov->lines += 1;
+            if (sscanf(line, "merged %" SCNx64 " %" SCNu64, &stamp, &bytes) == 2) {
+                if (stamp != ov->base_stamp || (off_t)bytes <= ov->merged) continue;
+                //The lines before are already in the graph: read the log again without them
+                changed = changed || ov->nupdates > 0;
+                overlay_reset(ov);
+                ov->merged = (off_t)bytes;
+                if (fseeko(f, 0, SEEK_SET) != 0) break;
+                continue;
+            }
+            if (ov->read <= ov->merged) continue;
+            if ((r = overlay_parse(ov->base, line, &u)) < 0) fprintf(stderr, "Skipping line %lu of %s: not an update of this graph.\n", ov->lines, ov->path);
+            else if (r > 0) {
+                ov->updates = (GraphUpdate*) grow(ov->updates, ov->nupdates, &ov->capupdates, sizeof(GraphUpdate));
+                ov->updates[ov->nupdates++] = u;
+                changed = true;
+            }
+        }
+        free(line);
+    }
+    fclose(f);
+    return changed;
+}
+
+//Follows the update log at path over the graph base, starting with the updates it already holds.
+void overlay_open(Overlay* ov, const Graph* base, const char* path) {
+    memset(ov, 0, sizeof(Overlay));
+    ov->base = base;
+    snprintf(ov->path, sizeof(ov->path), "%s", path);
+    ov->base_stamp = graph_stamp(base);
+    pthread_mutex_init(&ov->lock, NULL);
+    overlay_read(ov);
+    ov->current = overlay_build(base, ov->updates, ov->nupdates);
+    ov->next_check = now() + OVERLAY_CHECK;
+    if (ov->nupdates > 0) fprintf(stderr, "Applied %lu updates of %s.\n", ov->nupdates, ov->path);
+}
+
+//The latest snapshot of the updates, which the caller holds until overlay_release().
+OverlaySnapshot* overlay_acquire(Overlay* ov) {
+    pthread_mutex_lock(&ov->lock);
+    double t = now();
+    if (t >= ov->next_check) {
+        ov->next_check = t + OVERLAY_CHECK;
+        if (overlay_read(ov)) {
+            OverlaySnapshot* old = ov->current;
+            t = now();
+            ov->current = overlay_build(ov->base, ov->updates, ov->nupdates);
+            if (old->refs == 0) overlay_free(old);
+            fprintf(stderr, "Applied %lu updates of %s in %.3f ms.\n", ov->nupdates, ov->path, (now() - t) * 1e3);
+        }
+    }
+    OverlaySnapshot* snap = ov->current;
+    snap->refs += 1;
+    pthread_mutex_unlock(&ov->lock);
+    return snap;
+}
+
+//Releases a snapshot, and frees it if it has been replaced and this was its last query.
+void overlay_release(Overlay* ov, OverlaySnapshot* snap) {
+    pthread_mutex_lock(&ov->lock);
+    snap->refs -= 1;
+    if (snap->refs == 0 && snap != ov->current) overlay_free(snap);
+    pthread_mutex_unlock(&ov->lock);
+}
+
+void overlay_close(Overlay* ov) {
+    overlay_free(ov->current);
+    free(ov->updates);
+    pthread_mutex_destroy(&ov->lock);
+}
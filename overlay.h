@@ -0,0 +1,101 @@
+#ifndef OVERLAY_H
+#define OVERLAY_H
+
+#include <stdbool.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include "graph.h"
+
+/*Updates of the road network without converting the map again: closed streets, new streets and new
+lengths go to an update log next to the graph (map.upd for map.bin), which the router lays over the
+mapped file and compact merges into a new one.
+
+The log is a text file that is only appended to, one update per line (empty lines and lines
+starting with '#' are skipped):
+
+    remove from_id to_id            removes the edges from_id -> to_id
+    add from_id to_id [meters]      adds an edge, as long as the straight line between the nodes by default
+    weight from_id to_id meters     sets the length of the edges from_id -> to_id
+
+compact also appends a line of its own, "merged stamp bytes": the first bytes of the log are merged
+into the graph whose graph_stamp() is stamp (in hex). An overlay on that graph skips those lines, and
+an overlay on any other graph, such as a router still running on the file compact replaced, skips
+the marker and keeps applying every line. So the log is never rewritten, and no router loses an
+update whether it is restarted on the compacted graph or not.
+
+The ids are OSM node ids of the graph and the edges are directed, so a two-way street takes a line
+per direction. The updates apply in order, so a later line overrides an earlier one. A length is
+never shorter than the great-circle distance between its nodes (the heuristic relies on it), and it
+is rounded up as the converter stores it, so the graph with its updates gives the same distances as
+the file compact writes from them.
+
+The updates become a GraphPatch (graph.h): every node whose successors or predecessors change gets a
+new list, and the graph of a snapshot is the mapped graph with that patch. The searches read it as
+any other graph; a node without changes costs them one bit test. Building a snapshot takes time in
+the number of updates and of the nodes they touch, not in the size of the graph.
+
+An Overlay follows the log while the router runs. overlay_acquire() reads what has been appended
+since the last look (at most every OVERLAY_CHECK seconds) and returns the latest snapshot with a
+reference held. A query keeps its snapshot until overlay_release(), so a new update never changes
+the graph under a running search, and a replaced snapshot is freed by the last query that releases
+it. A log that shrinks or is replaced by another file is read again from its start; only complete
+lines are read, so a writer can append at any time.
+
+What remains to the writers: a line must be appended with a single write (as echo >> map.upd does),
+or under an exclusive flock() of the log, which is how compact appends its marker; otherwise the
+marker could land inside a line being written. The log keeps growing: it can be emptied, or
+replaced by a new file, once every router runs on the graph of its last marker, as a router on an
+older graph would lose the updates merged since.
+
+The landmarks of the file still give lower bounds as long as the updates only remove edges or make
+them longer; the hierarchy does not hold on a patched graph at all (shorter and nupdates tell).*/
+
+#define OVERLAY_CHECK   0.1
+
+enum updateKind {UPDATE_REMOVE, UPDATE_ADD, UPDATE_WEIGHT};
+
+typedef struct {
+    int kind;                   //updateKind
+    NodeIndex from, to;
+    double km;                  //Rounded length of UPDATE_ADD and UPDATE_WEIGHT
+} GraphUpdate;
+
+typedef struct {
+    Graph graph;                //The mapped graph, with the patch if there are updates
+    GraphPatch patch;
+    unsigned long nupdates;
+    bool shorter;               //Some edge was added or made shorter than in the file
+    unsigned long refs;         //Protected by the lock of the overlay
+    uint8_t* marks;             //Owned arrays of the patch
+    NodeIndex *nodes, *targets;
+    uint64_t* offsets;
+    double* weights;
+} OverlaySnapshot;
+
+typedef struct {
+    const Graph* base;
+    char path[4096];
+    pthread_mutex_t lock;
+    GraphUpdate* updates;
+    unsigned long nupdates, capupdates;
+    unsigned long lines;        //Lines of the log read so far
+    off_t read;                 //Bytes of the log read so far, up to the end of its last complete line
+    dev_t dev;
+    ino_t ino;
+    uint64_t base_stamp;        //graph_stamp() of the base, to recognise its merged lines
+    off_t merged;               //Bytes of the log merged into the base, from its marker
+    double next_check;
+    OverlaySnapshot* current;
+} Overlay;
+
+
+int overlay_parse(const Graph* base, const char* line, GraphUpdate* u);
+OverlaySnapshot* overlay_build(const Graph* base, const GraphUpdate* updates, unsigned long n);
+void overlay_free(OverlaySnapshot* snap);
+
+void overlay_open(Overlay* ov, const Graph* base, const char* path);
+OverlaySnapshot* overlay_acquire(Overlay* ov);
+void overlay_release(Overlay* ov, OverlaySnapshot* snap);
+void overlay_close(Overlay* ov);
+
+#endif
@@ -0,0 +1,818 @@
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include "search.h"
+
+
+/*The OPEN set is an indexed binary heap (heap.c). Compiling with -DOPEN_LIST brings back the
+sorted linked list we started with, so that both versions can still be benchmarked. The list keeps
+its length, peak and re-pushes in the size, peak and decreases of the (unused) heap, so that the
+statistics of both versions read the same.*/
+#ifdef OPEN_LIST
+//Structure for a node in the OPEN list
+typedef struct OL_node {
+    double f;
+    unsigned long index;
+    struct OL_node* next;
+} OL_node;
+#endif
+
+
+/*The following functions were built following the ones given in the delivery's pdf, the subject's notes 
+and random info from the internet.*/
+
+#ifdef OPEN_LIST
+//Function that takes a node out of the open list to push it again with a lower weight (a decrease-key of the heap).
+static void pop (unsigned long target, OL_node* OPEN, OpenHeap* counts) {
+    OL_node* TEMP = OPEN;
+    OL_node* PREV = NULL;
+    while (TEMP != NULL && TEMP->index != target) {
+        PREV = TEMP;
+        TEMP = TEMP->next;
+    }
+    PREV->next = TEMP->next;
+    free(TEMP);
+    counts->size -= 1;
+    counts->decreases += 1;
+}
+
+//Function that pushes a node into the open list taking into account its weight!
+static void push (unsigned long index, AStarStatus* PathData, OL_node* OPEN, OpenHeap* counts) {
+    (PathData + index)->whq = 1;
+    if (++counts->size > counts->peak) counts->peak = counts->size;
+    OL_node* TEMP = OPEN;                                                                 
+    OL_node* new_node = NULL;                                                             
+    if ((new_node = (OL_node*) malloc(sizeof(OL_node))) == NULL) ExitError("when allocating memory for a new node in the OPEN list", 1);
+    new_node->index = index;                                                                
+    new_node->f = PathData[index].g + PathData[index].h;
+    new_node->next = NULL;                                                                  
+    while ( (TEMP->next != NULL) && ((TEMP->next)->f <= new_node->f ) ) TEMP = TEMP->next;  
+    if (TEMP->next == NULL) TEMP->next = new_node;                                          
+    else if ((TEMP->next)->f > new_node->f) {                                               
+        new_node->next = TEMP->next;
+        TEMP->next = new_node;
+    }
+}
+#endif
+
+void search_init(SearchState* S, unsigned long nnodes) {
+    if ((S->PathData = (AStarStatus*) calloc(nnodes, sizeof(AStarStatus))) == NULL) ExitError("when allocating memory for the PathData vector", 3);
+    S->nnodes = nnodes;
+    S->generation = 0;
+    if ((S->OpenPos = (uint32_t*) malloc(nnodes*sizeof(uint32_t))) == NULL) ExitError("when allocating memory for the OPEN positions vector", 4);
+    heap_init(&S->open_set, 1024, S->OpenPos);
+    S->PathDataRev = NULL;
+    S->OpenPosRev = NULL;
+    S->ch = NULL;
+    S->path = NULL;
+    S->path_g = NULL;
+    S->path_len = S->path_cap = 0;
+    S->arcs = NULL;
+    S->arcs_cap = 0;
+    S->succ = NULL;
+    S->succ_cap = 0;
+    S->closed = NULL;
+    S->closed_len = S->closed_cap = 0;
+    S->recost = NULL;
+    S->bound = 1;
+    S->expanded_nodes_counter = S->expanded_backward = 0;
+    S->timed = false;
+    memset(&S->stats, 0, sizeof(SearchStats));
+}
+
+void search_free(SearchState* S) {
+    free(S->PathData);
+    heap_free(&S->open_set);
+    free(S->OpenPos);
+    if (S->PathDataRev != NULL) {
+        free(S->PathDataRev);
+        heap_free(&S->open_rev);
+        free(S->OpenPosRev);
+    }
+    free(S->path);
+    free(S->path_g);
+    free(S->arcs);
+    free(S->succ);
+    free(S->closed);
+}
+
+//Status of a node in the current query, in PathData or in PathDataRev.
+static inline AStarStatus* status(SearchState* S, AStarStatus* data, unsigned long index) {
+    AStarStatus* st = data + index;
+    if (st->gen != S->generation) {
+        S->stats.touched += 1;
+        st->gen = S->generation;
+        st->whq = 0;
+        st->g = INFINITY;
+    }
+    return st;
+}
+
+static double monotonic_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+//Seconds on a monotonic clock when the phases of the queries are timed, 0 otherwise.
+static double stats_clock(const SearchState* S) {
+    return S->timed ? monotonic_seconds() : 0;
+}
+
+//Clears the statistics of the previous query and returns the time the new one starts at.
+static double stats_start(SearchState* S) {
+    memset(&S->stats, 0, sizeof(SearchStats));
+    return stats_clock(S);
+}
+
+//Ends the statistics of a query whose search loop started at t (both: the backward heap was used too).
+static void stats_finish(SearchState* S, double t, bool both) {
+    S->stats.search_time = stats_clock(S) - t;
+    S->stats.peak_open = S->open_set.peak + (both ? S->open_rev.peak : 0);
+    S->stats.decreased = S->open_set.decreases + (both ? S->open_rev.decreases : 0);
+}
+
+//Starts a new query: the entries of the previous ones become stale.
+static void new_generation(SearchState* S) {
+    S->generation = (S->generation + 1) & ((1u << SEARCH_GEN_BITS) - 1);
+    if (S->generation == 0) {
+        //The counter wrapped around: this is the only time the whole vectors are reset.
+        unsigned long i;
+        for (i = 0; i < S->nnodes; i++) S->PathData[i].gen = 0;
+        if (S->PathDataRev != NULL) for (i = 0; i < S->nnodes; i++) S->PathDataRev[i].gen = 0;
+        S->generation = 1;
+    }
+    S->bound = 1;
+    S->recost = NULL;
+}
+
+
+/*Successors of a node, or its predecessors with backward, as graph_adjacent() gives them. A packed
+adjacency is decoded into S->succ, which holds one list at a time.*/
+static inline unsigned long successors(const Graph* graph, SearchState* S, bool backward, unsigned long index,
+                                       const NodeIndex** targets, unsigned long* first) {
+    if (graph->blocks != NULL && graph->max_degree > S->succ_cap) {
+        free(S->succ);
+        S->succ_cap = graph->max_degree;
+        if ((S->succ = (NodeIndex*) malloc(S->succ_cap*sizeof(NodeIndex))) == NULL) ExitError("when allocating memory for the successor vector", 6);
+    }
+    return graph_adjacent(graph, backward, index, S->succ, targets, first);
+}
+
+/*Great-circle distances from the n successors targets[] of the node being expanded to the node to,
+computed in one batch (see geo.h) into S->arcs + slot*n. Returns NULL when the batch is too narrow
+to pay: the caller then computes the distances it needs one by one.*/
+static const double* successor_arcs(const Graph* graph, SearchState* S, const NodeIndex* targets, unsigned long n,
+                                    unsigned long to, int slot) {
+    if (GEO_BATCH_WIDTH < 4) return NULL;
+    if (2*n > S->arcs_cap) {
+        free(S->arcs);
+        S->arcs_cap = 4*n;
+        if ((S->arcs = (double*) malloc(S->arcs_cap*sizeof(double))) == NULL) ExitError("when allocating memory for the heuristic vector", 6);
+    }
+    geo_arc_batch(graph->unitvecs, targets, n, graph->unitvecs[to], S->arcs + slot*n);
+    return S->arcs + slot*n;
+}
+
+/*Heuristic of A*: the great-circle distance (haversine() from the unit vectors, minus GEO_SLACK),
+raised to the landmark bound when there are landmarks. arc is the distance when it is already
+known, or a negative number.*/
+static inline double heuristic(const Graph* graph, const Landmarks* lm, unsigned long index, unsigned long dest_index, double arc) {
+    double h = ((arc < 0) ? graph_arc(graph, index, dest_index) : arc) - GEO_SLACK;
+    if (h < 0) h = 0;
+    if (lm != NULL) {
+        double b = landmarks_bound(lm, index, dest_index);
+        if (b > h) h = b;
+    }
+    return h;
+}
+
+/*A* algorithm as a function. Returns false if the destination cannot be reached from the source.
+The landmark bound is admissible but, as it is read from rounded floats, it can be off consistency
+by a hair, so with landmarks a closed node that gets a shorter g is opened again.*/
+static bool astar_search (const Graph* graph, const Landmarks* lm, SearchState* S, unsigned long source_index, unsigned long dest_index) {
+    
+    double t0 = stats_start(S);
+    AStarStatus* PathData = S->PathData;
+    new_generation(S);
+    S->ch = NULL;
+    AStarStatus* succ;
+    status(S, PathData, source_index)->whq = 1;                                                           
+    PathData[source_index].g = 0;                                                             
+    PathData[source_index].h = heuristic(graph, lm, source_index, dest_index, -1);            
+    heap_reset(&S->open_set);       //Also with the OPEN list, which keeps its statistics there
+#ifdef OPEN_LIST
+    struct OL_node* OPEN = NULL;                                                         
+    if ((OPEN = (OL_node*) malloc(sizeof(OL_node))) == NULL) ExitError("when allocating memory for the OPEN list", 4);
+    struct OL_node* AUX = NULL;
+    OPEN->index = source_index;
+    OPEN->f = PathData[source_index].g + PathData[source_index].h;
+    OPEN->next = NULL;
+    S->open_set.size = S->open_set.peak = 1;
+#else
+    heap_push(&S->open_set, source_index, PathData[source_index].g + PathData[source_index].h);
+#endif
+    unsigned long cur_index = source_index;
+    unsigned long succ_count, nsucc, first;
+    unsigned long succ_index;                   
+    const NodeIndex* succ_targets;
+    double successor_current_cost;              
+    double w;                                   
+    const double* arcs;
+    S->expanded_nodes_counter = 0;
+    S->expanded_backward = 0;
+    double t1 = stats_clock(S);
+    S->stats.init_time = t1 - t0;
+#ifdef OPEN_LIST
+    while (OPEN != NULL) {
+        cur_index = OPEN->index;
+        S->open_set.size -= 1;      //The head stays in the list until it is expanded, but is out of OPEN
+#else
+    while (!heap_empty(&S->open_set)) {
+        cur_index = heap_pop(&S->open_set);
+#endif
+        S->expanded_nodes_counter += 1;
+        if (cur_index == dest_index) break;
+        nsucc = successors(graph, S, false, cur_index, &succ_targets, &first);
+        S->stats.relaxed += nsucc;
+        arcs = successor_arcs(graph, S, succ_targets, nsucc, dest_index, 0);
+        for (succ_count = 0; succ_count < nsucc; succ_count++) {   
+            succ_index = succ_targets[succ_count];                 
+            succ = status(S, PathData, succ_index);
+            w = graph_weight(graph, first + succ_count);                   
+            successor_current_cost = PathData[cur_index].g + w;                    
+            if ( succ->whq == 1 ) {
+                if ( succ->g <= successor_current_cost ) continue;   
+#ifdef OPEN_LIST
+                else pop(succ_index, OPEN, &S->open_set);                  
+#endif
+            }
+            else if ( succ->whq == 2 ) {
+                if ( lm == NULL || succ->g <= successor_current_cost ) continue;
+            }
+            else succ->h = heuristic(graph, lm, succ_index, dest_index, (arcs != NULL) ? arcs[succ_count] : -1);
+            
+            succ->g = successor_current_cost;                       
+            succ->parent = cur_index;                                
+#ifdef OPEN_LIST
+            push(succ_index, PathData, OPEN, &S->open_set);
+#else
+            if ( succ->whq == 1 ) heap_decrease(&S->open_set, succ_index, successor_current_cost + succ->h);
+            else {
+                succ->whq = 1;
+                heap_push(&S->open_set, succ_index, successor_current_cost + succ->h);
+            }
+#endif
+        }
+        PathData[cur_index].whq = 2;                                               
+#ifdef OPEN_LIST
+        AUX = OPEN->next;   free(OPEN);     OPEN = AUX;
+#endif
+    }
+#ifdef OPEN_LIST
+    bool found = (OPEN != NULL);
+    while (OPEN != NULL) {                                                              
+        AUX = OPEN->next;   free(OPEN);     OPEN = AUX;
+    }
+#else
+    bool found = (cur_index == dest_index);
+#endif
+    S->meet = dest_index;
+    S->distance = found ? PathData[dest_index].g : INFINITY;
+    stats_finish(S, t1, false);
+    return found;
+}
+
+bool AStar (const Graph* graph, SearchState* S, unsigned long source_index, unsigned long dest_index) {
+    return astar_search(graph, NULL, S, source_index, dest_index);
+}
+
+//A* with the ALT heuristic of the landmarks lm.
+bool AStarALT (const Graph* graph, const Landmarks* lm, SearchState* S, unsigned long source_index, unsigned long dest_index) {
+    return astar_search(graph, lm, S, source_index, dest_index);
+}
+
+
+/*Bidirectional A*. A forward search from the source on the successors and a backward search from
+the destination on the reverse adjacency run in turns, always expanding the side with the smaller
+key. Both use the average potential pf(v) = (h(v,dest) - h(source,v)) / 2 (and pr = -pf for the
+backward side), so they are consistent with each other and a node settled on one side is never
+reopened. Every time an edge reaches a node labelled by the other side, the path through it is a
+candidate; the search stops when the sum of both keys cannot improve the best one.*/
+static inline double bi_potential(const Graph* graph, unsigned long v, unsigned long source_index, unsigned long dest_index) {
+    return (graph_arc(graph, v, dest_index) - graph_arc(graph, source_index, v)) / 2;
+}
+
+//Expands the top node of one side.
+static void bi_expand(const Graph* graph, SearchState* S, bool backward, unsigned long source_index, unsigned long dest_index) {
+    AStarStatus* mine  = backward ? S->PathDataRev : S->PathData;
+    AStarStatus* other = backward ? S->PathData : S->PathDataRev;
+    OpenHeap* heap     = backward ? &S->open_rev : &S->open_set;
+    const void* weights     = backward ? graph->rev_weights : graph->weights;
+    const NodeIndex* targets;
+    double sign = backward ? -1 : 1;
+    unsigned long k, first, cur_index = heap_pop(heap), succ_index;
+    AStarStatus *succ, *twin;
+    double g;
+
+    mine[cur_index].whq = 2;
+    if (backward) S->expanded_backward += 1;
+    else S->expanded_nodes_counter += 1;
+    unsigned long n = successors(graph, S, backward, cur_index, &targets, &first);
+    S->stats.relaxed += n;
+    const double* to_dest = successor_arcs(graph, S, targets, n, dest_index, 0);
+    const double* from_source = successor_arcs(graph, S, targets, n, source_index, 1);
+    for (k = 0; k < n; k++) {
+        succ_index = targets[k];
+        succ = status(S, mine, succ_index);
+        if (succ->whq == 2) continue;
+        g = mine[cur_index].g + graph_weight_of(graph, weights, first + k);
+        if (succ->whq == 1 && succ->g <= g) continue;
+        if (succ->whq == 0 && to_dest != NULL) succ->h = sign * (to_dest[k] - from_source[k]) / 2;
+        else if (succ->whq == 0) succ->h = sign * bi_potential(graph, succ_index, source_index, dest_index);
+        succ->g = g;
+        succ->parent = cur_index;
+        if (succ->whq == 1) heap_decrease(heap, succ_index, g + succ->h);
+        else {
+            succ->whq = 1;
+            heap_push(heap, succ_index, g + succ->h);
+        }
+        twin = status(S, other, succ_index);
+        if (g + twin->g < S->distance) {
+            S->distance = g + twin->g;
+            S->meet = succ_index;
+        }
+    }
+}
+
+//Allocates the arrays of the backward search the first time a bidirectional search needs them.
+static void backward_init(SearchState* S) {
+    if (S->PathDataRev != NULL) return;
+    if ((S->PathDataRev = (AStarStatus*) calloc(S->nnodes, sizeof(AStarStatus))) == NULL ||
+        (S->OpenPosRev = (uint32_t*) malloc(S->nnodes*sizeof(uint32_t))) == NULL)
+            ExitError("when allocating memory for the backward search", 3);
+    heap_init(&S->open_rev, 1024, S->OpenPosRev);
+}
+
+//Bidirectional A*. Returns false if the destination cannot be reached from the source.
+bool BiAStar (const Graph* graph, SearchState* S, unsigned long source_index, unsigned long dest_index) {
+    double t0 = stats_start(S);
+    backward_init(S);
+    new_generation(S);
+    S->ch = NULL;
+    S->expanded_nodes_counter = S->expanded_backward = 0;
+    heap_reset(&S->open_set);
+    heap_reset(&S->open_rev);
+
+    AStarStatus* st = status(S, S->PathData, source_index);
+    st->whq = 1;
+    st->g = 0;
+    st->h = bi_potential(graph, source_index, source_index, dest_index);
+    heap_push(&S->open_set, source_index, st->h);
+    st = status(S, S->PathDataRev, dest_index);
+    st->whq = 1;
+    st->g = 0;
+    st->h = -bi_potential(graph, dest_index, source_index, dest_index);
+    heap_push(&S->open_rev, dest_index, st->h);
+
+    S->distance = INFINITY;
+    S->meet = source_index;
+    if (source_index == dest_index) S->distance = 0;
+    double t1 = stats_clock(S);
+    S->stats.init_time = t1 - t0;
+    while (!heap_empty(&S->open_set) && !heap_empty(&S->open_rev)) {
+        if (heap_min(&S->open_set) + heap_min(&S->open_rev) >= S->distance) break;
+        bi_expand(graph, S, heap_min(&S->open_rev) < heap_min(&S->open_set), source_index, dest_index);
+    }
+    stats_finish(S, t1, true);
+    return S->distance < INFINITY;
+}
+
+
+/*Weighted and anytime A*, after ARA* (Likhachev, Gordon and Thrun, 2003). A round is an A* with the
+keys g + (1+epsilon) h that never reopens a node: a closed node that gets a shorter g is put aside
+(INCONS) for the next round instead. The round stops as soon as no key in OPEN is below g(dest), and
+then the path is at most 1+epsilon times the shortest one. The anytime search goes on with a lower
+epsilon, starting from where the last round stopped with the nodes put aside back in OPEN, until
+epsilon reaches 0 or a limit is hit; each round can only shorten the path.
+
+Whatever the round, the smallest g + h in OPEN and among the nodes put aside is a lower bound of
+the shortest distance (the first node of a shortest path whose g is still too high has a parent
+on that path in one of them), so the bound achieved is g(dest) over it, and never more than the
+1+epsilon of the last finished round.*/
+#define ANYTIME_MIN_EPSILON     0.001       //Below this the next round is exact
+#define ANYTIME_CLOCK_EVERY     64          //Expansions between two reads of the clock
+
+static void closed_push(SearchState* S, unsigned long index) {
+    if (S->closed_len == S->closed_cap) {
+        S->closed_cap = S->closed_cap ? 2*S->closed_cap : 1024;
+        if ((S->closed = (NodeIndex*) realloc(S->closed, S->closed_cap*sizeof(NodeIndex))) == NULL)
+            ExitError("when allocating memory for the closed nodes", 6);
+    }
+    S->closed[S->closed_len++] = (NodeIndex)index;
+}
+
+//Smallest g + h in OPEN and among the nodes put aside, or at most limit.
+static double lower_bound(const SearchState* S, double limit) {
+    unsigned long i;
+    for (i = 0; i < S->open_set.size; i++) {
+        const AStarStatus* st = S->PathData + S->open_set.items[i].index;
+        if (st->g + st->h < limit) limit = st->g + st->h;
+    }
+    for (i = 0; i < S->closed_len; i++) {
+        const AStarStatus* st = S->PathData + S->closed[i];
+        if (st->whq == INCONS && st->g + st->h < limit) limit = st->g + st->h;
+    }
+    return limit;
+}
+
+//Starts the next round with weight w: OPEN gets the new keys and the nodes put aside, and nothing is closed.
+static void next_round(SearchState* S, double w) {
+    unsigned long i;
+    for (i = 0; i < S->open_set.size; i++) {
+        const AStarStatus* st = S->PathData + S->open_set.items[i].index;
+        S->open_set.items[i].f = st->g + w*st->h;
+    }
+    heap_heapify(&S->open_set);
+    for (i = 0; i < S->closed_len; i++) {
+        AStarStatus* st = S->PathData + S->closed[i];
+        if (st->whq == INCONS) {
+            st->whq = OPEN;
+            heap_push(&S->open_set, S->closed[i], st->g + w*st->h);
+        }
+        else st->whq = NONE;
+    }
+    S->closed_len = 0;
+}
+
+static bool anytime_search(const Graph* graph, SearchState* S, unsigned long source_index, unsigned long dest_index,
+                           const SuboptimalLimits* limits, bool anytime) {
+    double t0 = stats_start(S);
+    double start = anytime ? monotonic_seconds() : 0;
+    AStarStatus* PathData = S->PathData;
+    new_generation(S);
+    S->ch = NULL;
+    S->recost = graph;
+    S->expanded_nodes_counter = S->expanded_backward = 0;
+    S->closed_len = 0;
+    heap_reset(&S->open_set);
+    double epsilon = (limits->epsilon > 0) ? limits->epsilon : 0, w = 1 + epsilon;
+    AStarStatus* st = status(S, PathData, source_index);
+    AStarStatus* dest = status(S, PathData, dest_index);
+    st->g = 0;
+    st->h = heuristic(graph, NULL, source_index, dest_index, -1);
+    st->whq = OPEN;
+    heap_push(&S->open_set, source_index, w*st->h);
+    double t1 = stats_clock(S);
+    S->stats.init_time = t1 - t0;
+
+    AStarStatus* succ;
+    const double* arcs;
+    const NodeIndex* targets;
+    unsigned long cur_index, succ_index, k, n, first;
+    double g, bound = INFINITY;
+    bool stopped = false;
+    while (true) {
+        while (!heap_empty(&S->open_set) && heap_min(&S->open_set) < dest->g) {
+            if (anytime && dest->g < INFINITY) {
+                if (limits->max_expanded > 0 && S->expanded_nodes_counter >= limits->max_expanded) stopped = true;
+                else if (limits->time_limit > 0 && S->expanded_nodes_counter % ANYTIME_CLOCK_EVERY == 0 &&
+                         monotonic_seconds() - start >= limits->time_limit) stopped = true;
+                if (stopped) break;
+            }
+            cur_index = heap_pop(&S->open_set);
+            PathData[cur_index].whq = CLOSED;
+            closed_push(S, cur_index);
+            S->expanded_nodes_counter += 1;
+            n = successors(graph, S, false, cur_index, &targets, &first);
+            S->stats.relaxed += n;
+            arcs = successor_arcs(graph, S, targets, n, dest_index, 0);
+            for (k = 0; k < n; k++) {
+                succ_index = targets[k];
+                succ = status(S, PathData, succ_index);
+                g = PathData[cur_index].g + graph_weight(graph, first + k);
+                if (succ->g <= g) continue;
+                if (succ->g == INFINITY) succ->h = heuristic(graph, NULL, succ_index, dest_index, (arcs != NULL) ? arcs[k] : -1);
+                succ->g = g;
+                succ->parent = cur_index;
+                if (succ->whq == OPEN) heap_decrease(&S->open_set, succ_index, g + w*succ->h);
+                else if (succ->whq == CLOSED) succ->whq = INCONS;
+                else if (succ->whq == NONE) {
+                    succ->whq = OPEN;
+                    heap_push(&S->open_set, succ_index, g + w*succ->h);
+                }
+            }
+        }
+        if (dest->g == INFINITY) break;
+        double lb = lower_bound(S, dest->g);
+        if (lb > 0 && dest->g / lb < bound) bound = dest->g / lb;
+        else if (lb <= 0) bound = 1;
+        if (!stopped && w < bound) bound = w;
+        if (stopped || !anytime || epsilon == 0 || bound <= 1) break;
+        if ((limits->max_expanded > 0 && S->expanded_nodes_counter >= limits->max_expanded) ||
+            (limits->time_limit > 0 && monotonic_seconds() - start >= limits->time_limit)) break;
+        epsilon = (epsilon / 2 < bound - 1) ? epsilon / 2 : bound - 1;
+        if (epsilon < ANYTIME_MIN_EPSILON) epsilon = 0;
+        w = 1 + epsilon;
+        next_round(S, w);
+    }
+    S->meet = dest_index;
+    S->distance = dest->g;
+    S->bound = (dest->g < INFINITY) ? bound : 1;
+    stats_finish(S, t1, false);
+    return dest->g < INFINITY;
+}
+
+//A* with the keys g + (1+epsilon) h: a path at most 1+epsilon times the shortest one, usually much faster.
+bool WeightedAStar (const Graph* graph, SearchState* S, unsigned long source_index, unsigned long dest_index, double epsilon) {
+    SuboptimalLimits limits = {epsilon, 0, 0};
+    return anytime_search(graph, S, source_index, dest_index, &limits, false);
+}
+
+//Anytime A*: the best path found within the limits, with the bound it reached in S->bound.
+bool AnytimeAStar (const Graph* graph, SearchState* S, unsigned long source_index, unsigned long dest_index, const SuboptimalLimits* limits) {
+    return anytime_search(graph, S, source_index, dest_index, limits, true);
+}
+
+
+/*Query of a contraction hierarchy: a Dijkstra search up the hierarchy from each end, the backward
+one on the down edges. A side stops once its smallest key reaches the best path found, as every
+node it could still settle is farther. The parents are edges of the hierarchy, which
+rebuild_path() unpacks.
+
+A node is not expanded (stall on demand) when a higher node already labelled by the same side
+reaches it with a shorter distance through an edge going down: its label is not a shortest
+distance, so nothing it reaches can be part of the shortest path.*/
+bool CHSearch (const CHGraph* ch, SearchState* S, unsigned long source_index, unsigned long dest_index) {
+    double t0 = stats_start(S);
+    backward_init(S);
+    new_generation(S);
+    S->ch = ch;
+    S->expanded_nodes_counter = S->expanded_backward = 0;
+    heap_reset(&S->open_set);
+    heap_reset(&S->open_rev);
+
+    AStarStatus* st = status(S, S->PathData, source_index);
+    st->whq = 1;
+    st->g = 0;
+    heap_push(&S->open_set, source_index, 0);
+    st = status(S, S->PathDataRev, dest_index);
+    st->whq = 1;
+    st->g = 0;
+    heap_push(&S->open_rev, dest_index, 0);
+
+    S->distance = INFINITY;
+    S->meet = source_index;
+    if (source_index == dest_index) S->distance = 0;
+    double t1 = stats_clock(S);
+    S->stats.init_time = t1 - t0;
+    while (true) {
+        if (!heap_empty(&S->open_set) && heap_min(&S->open_set) >= S->distance) S->open_set.size = 0;
+        if (!heap_empty(&S->open_rev) && heap_min(&S->open_rev) >= S->distance) S->open_rev.size = 0;
+        if (heap_empty(&S->open_set) && heap_empty(&S->open_rev)) break;
+        bool backward = heap_empty(&S->open_set) || (!heap_empty(&S->open_rev) && heap_min(&S->open_rev) < heap_min(&S->open_set));
+        AStarStatus* mine  = backward ? S->PathDataRev : S->PathData;
+        AStarStatus* other = backward ? S->PathData : S->PathDataRev;
+        OpenHeap* heap     = backward ? &S->open_rev : &S->open_set;
+        const uint64_t* offsets = backward ? ch->down_offsets : ch->up_offsets;
+        const CHEdge* edges     = backward ? ch->down : ch->up;
+        const uint64_t* stall_offsets = backward ? ch->up_offsets : ch->down_offsets;
+        const CHEdge* stall_edges     = backward ? ch->up : ch->down;
+        unsigned long e, cur_index = heap_pop(heap), succ_index;
+        AStarStatus *succ, *twin;
+        double g;
+
+        mine[cur_index].whq = 2;
+        for (e = stall_offsets[cur_index]; e < stall_offsets[cur_index+1]; e++)
+            if (status(S, mine, stall_edges[e].node)->g + stall_edges[e].weight < mine[cur_index].g) break;
+        if (e < stall_offsets[cur_index+1]) continue;
+        if (backward) S->expanded_backward += 1;
+        else S->expanded_nodes_counter += 1;
+        S->stats.relaxed += offsets[cur_index+1] - offsets[cur_index];
+        for (e = offsets[cur_index]; e < offsets[cur_index+1]; e++) {
+            succ_index = edges[e].node;
+            succ = status(S, mine, succ_index);
+            g = mine[cur_index].g + edges[e].weight;
+            if (succ->g <= g) continue;
+            succ->g = g;
+            succ->parent = cur_index;
+            if (succ->whq == 1) heap_decrease(heap, succ_index, g);
+            else {
+                succ->whq = 1;
+                heap_push(heap, succ_index, g);
+            }
+            twin = status(S, other, succ_index);
+            if (g + twin->g < S->distance) {
+                S->distance = g + twin->g;
+                S->meet = succ_index;
+            }
+        }
+    }
+    stats_finish(S, t1, true);
+    return S->distance < INFINITY;
+}
+
+
+/*One-to-many search: Dijkstra from the source until every node marked in the bitmap marks (bit
+v%8 of marks[v/8], ntargets distinct nodes) is settled, or nothing else can be reached. A single
+search gives the distances to all the targets, read with search_label(), and their paths, with
+tree_path(). Returns false if some target cannot be reached.*/
+bool OneToMany (const Graph* graph, SearchState* S, unsigned long source_index, const uint8_t* marks, unsigned long ntargets) {
+    double t0 = stats_start(S);
+    AStarStatus* PathData = S->PathData;
+    new_generation(S);
+    S->ch = NULL;
+    S->expanded_nodes_counter = S->expanded_backward = 0;
+    heap_reset(&S->open_set);
+    AStarStatus* st = status(S, PathData, source_index);
+    st->g = 0;
+    st->whq = OPEN;
+    heap_push(&S->open_set, source_index, 0);
+    double t1 = stats_clock(S);
+    S->stats.init_time = t1 - t0;
+
+    unsigned long left = ntargets, cur_index, succ_index, k, n, first;
+    const NodeIndex* targets;
+    AStarStatus* succ;
+    double g;
+    while (left > 0 && !heap_empty(&S->open_set)) {
+        cur_index = heap_pop(&S->open_set);
+        PathData[cur_index].whq = CLOSED;
+        S->expanded_nodes_counter += 1;
+        if (marks[cur_index >> 3] & (1u << (cur_index & 7))) left -= 1;
+        n = successors(graph, S, false, cur_index, &targets, &first);
+        S->stats.relaxed += n;
+        for (k = 0; k < n; k++) {
+            succ_index = targets[k];
+            succ = status(S, PathData, succ_index);
+            g = PathData[cur_index].g + graph_weight(graph, first + k);
+            if (succ->g <= g) continue;
+            succ->g = g;
+            succ->parent = cur_index;
+            if (succ->whq == OPEN) heap_decrease(&S->open_set, succ_index, g);
+            else {
+                succ->whq = OPEN;
+                heap_push(&S->open_set, succ_index, g);
+            }
+        }
+    }
+    stats_finish(S, t1, false);
+    return left == 0;
+}
+
+/*Upward search of a contraction hierarchy from one node, on the up edges or, if backward, on the
+down edges backwards: the half of CHSearch() that a distance table runs once per source and once
+per target. It runs until its queue is empty and leaves the nodes it settles without stalling in
+S->closed[0 .. n-1], with their distances for search_label(). Returns n.*/
+unsigned long CHUpward (const CHGraph* ch, SearchState* S, unsigned long index, bool backward) {
+    double t0 = stats_start(S);
+    backward_init(S);
+    new_generation(S);
+    S->ch = ch;
+    S->expanded_nodes_counter = S->expanded_backward = 0;
+    S->closed_len = 0;
+    heap_reset(&S->open_set);
+    heap_reset(&S->open_rev);
+    AStarStatus* data = backward ? S->PathDataRev : S->PathData;
+    OpenHeap* heap    = backward ? &S->open_rev : &S->open_set;
+    const uint64_t* offsets = backward ? ch->down_offsets : ch->up_offsets;
+    const CHEdge* edges     = backward ? ch->down : ch->up;
+    const uint64_t* stall_offsets = backward ? ch->up_offsets : ch->down_offsets;
+    const CHEdge* stall_edges     = backward ? ch->up : ch->down;
+    AStarStatus* st = status(S, data, index);
+    st->whq = OPEN;
+    st->g = 0;
+    heap_push(heap, index, 0);
+    double t1 = stats_clock(S);
+    S->stats.init_time = t1 - t0;
+
+    unsigned long e, cur_index, succ_index;
+    AStarStatus* succ;
+    double g;
+    while (!heap_empty(heap)) {
+        cur_index = heap_pop(heap);
+        data[cur_index].whq = CLOSED;
+        for (e = stall_offsets[cur_index]; e < stall_offsets[cur_index+1]; e++)
+            if (status(S, data, stall_edges[e].node)->g + stall_edges[e].weight < data[cur_index].g) break;
+        if (e < stall_offsets[cur_index+1]) continue;
+        if (backward) S->expanded_backward += 1;
+        else S->expanded_nodes_counter += 1;
+        closed_push(S, cur_index);
+        S->stats.relaxed += offsets[cur_index+1] - offsets[cur_index];
+        for (e = offsets[cur_index]; e < offsets[cur_index+1]; e++) {
+            succ_index = edges[e].node;
+            succ = status(S, data, succ_index);
+            g = data[cur_index].g + edges[e].weight;
+            if (succ->g <= g) continue;
+            succ->g = g;
+            succ->parent = cur_index;
+            if (succ->whq == OPEN) heap_decrease(heap, succ_index, g);
+            else {
+                succ->whq = OPEN;
+                heap_push(heap, succ_index, g);
+            }
+        }
+    }
+    stats_finish(S, t1, true);
+    return S->closed_len;
+}
+
+//Distance to a node in the last search (in its backward half if backward), INFINITY if it was not reached.
+double search_label(const SearchState* S, unsigned long index, bool backward) {
+    const AStarStatus* st = (backward ? S->PathDataRev : S->PathData) + index;
+    return (st->gen == S->generation) ? st->g : INFINITY;
+}
+
+//Makes room for a path of len nodes in S->path and S->path_g.
+static void path_reserve(SearchState* S, unsigned long len) {
+    if (len <= S->path_cap) return;
+    free(S->path);
+    free(S->path_g);
+    S->path_cap = 2*len;
+    if ((S->path = (unsigned long*) malloc(S->path_cap*sizeof(unsigned long))) == NULL ||
+        (S->path_g = (double*) malloc(S->path_cap*sizeof(double))) == NULL) ExitError("when allocating memory for the path vector", 6);
+}
+
+//Shortest edge from u to v in the graph.
+static double edge_weight(const Graph* graph, SearchState* S, unsigned long u, unsigned long v) {
+    double w = INFINITY;
+    const NodeIndex* targets;
+    unsigned long k, first, n = successors(graph, S, false, u, &targets, &first);
+    for (k = 0; k < n; k++)
+        if (targets[k] == v && graph_weight(graph, first + k) < w) w = graph_weight(graph, first + k);
+    return w;
+}
+
+/*Replaces the path of a CHSearch() query, made of hierarchy edges, with the original nodes. The
+distances are added up again along the unpacked path, edge after edge from the source, so they
+come out exactly as A* adds them.*/
+static unsigned long unpack_path(SearchState* S) {
+    const CHGraph* ch = S->ch;
+    unsigned long i, k, len = 1, packed_len = S->path_len;
+    for (i = 1; i < packed_len; i++) len += ch_unpack(ch, S->path[i-1], S->path[i], NULL);
+    unsigned long* packed;
+    if ((packed = (unsigned long*) malloc(packed_len*sizeof(unsigned long))) == NULL) ExitError("when allocating memory for the path vector", 6);
+    memcpy(packed, S->path, packed_len*sizeof(unsigned long));
+    path_reserve(S, len);
+    S->path[0] = packed[0];
+    for (i = 1, k = 1; i < packed_len; i++) k += ch_unpack(ch, packed[i-1], packed[i], S->path + k);
+    free(packed);
+    S->path_g[0] = 0;
+    for (k = 1; k < len; k++) S->path_g[k] = S->path_g[k-1] + edge_weight(ch->graph, S, S->path[k-1], S->path[k]);
+    S->distance = S->path_g[len-1];
+    S->path_len = len;
+    return len;
+}
+
+/*Rebuilds the path found by the last search into S->path and returns its length. The forward
+parents lead from the meeting node back to the source and the backward ones from the meeting node
+on to the destination. After an anytime search the g of a node can be above its distance along
+the path (its parent got a shorter g later), so the path is added up again.*/
+static unsigned long follow_parents(SearchState* S, unsigned long source_index, unsigned long dest_index) {
+    unsigned long cur_index = S->meet;
+    unsigned long path_len = 1;
+    while (cur_index != source_index) {
+        path_len += 1;
+        cur_index = S->PathData[cur_index].parent;
+    }
+    for (cur_index = S->meet; cur_index != dest_index; cur_index = S->PathDataRev[cur_index].parent) path_len += 1;
+    path_reserve(S, path_len);
+    unsigned long i = path_len;
+    for (cur_index = S->meet; cur_index != dest_index; cur_index = S->PathDataRev[cur_index].parent) i -= 1;
+    unsigned long k = i - 1;
+    cur_index = S->meet;
+    while (true) {
+        S->path[k] = cur_index;
+        S->path_g[k] = S->PathData[cur_index].g;
+        if (cur_index == source_index) break;
+        cur_index = S->PathData[cur_index].parent;
+        k -= 1;
+    }
+    for (cur_index = S->meet; cur_index != dest_index; i++) {
+        cur_index = S->PathDataRev[cur_index].parent;
+        S->path[i] = cur_index;
+        S->path_g[i] = S->distance - S->PathDataRev[cur_index].g;
+    }
+    S->path_len = path_len;
+    if (S->ch != NULL) return unpack_path(S);
+    if (S->recost != NULL) {
+        for (k = 1; k < path_len; k++) S->path_g[k] = S->path_g[k-1] + edge_weight(S->recost, S, S->path[k-1], S->path[k]);
+        S->distance = S->path_g[path_len-1];
+    }
+    return path_len;
+}
+
+unsigned long rebuild_path(SearchState* S, unsigned long source_index, unsigned long dest_index) {
+    double t0 = stats_clock(S);
+    unsigned long path_len = follow_parents(S, source_index, dest_index);
+    S->stats.rebuild_time = stats_clock(S) - t0;
+    return path_len;
+}
+
+//Path of the last OneToMany() search to one of its targets (reached), as rebuild_path() leaves it.
+unsigned long tree_path(SearchState* S, unsigned long source_index, unsigned long target_index) {
+    S->meet = target_index;
+    S->distance = search_label(S, target_index, false);
+    return rebuild_path(S, source_index, target_index);
+}
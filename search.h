@@ -0,0 +1,99 @@
+#ifndef SEARCH_H
+#define SEARCH_H
+
+#include <stdbool.h>
+#include "graph.h"
+#include "heap.h"
+#include "landmarks.h"
+#include "ch.h"
+
+/*Re-entrant A* search, unidirectional (AStar, or AStarALT with landmarks) or bidirectional (BiAStar),
+its bounded-suboptimal and anytime versions (WeightedAStar, AnytimeAStar), the query of a
+contraction hierarchy (CHSearch), and the one-to-many searches the distance tables are made of
+(OneToMany, CHUpward; see matrix.h). All the state of a search lives in an explicit SearchState, so several
+threads can route at the same time on one shared, read-only Graph, each one with its own state.
+Nothing here prints or stops the process when there is no path: the caller decides what to do.*/
+
+enum whichQueue {NONE, OPEN, CLOSED, INCONS};     //INCONS: closed, then reached again by a shorter path (AnytimeAStar)
+
+/*Search state of a node, 24 bytes: the generation and the queue share one 32-bit word and the
+parent is a 32-bit node index.*/
+#define SEARCH_GEN_BITS 30
+
+typedef struct {
+    double g, h;                
+    NodeIndex parent;
+    unsigned int gen : SEARCH_GEN_BITS;     //Query that last touched the node (see SearchState)
+    unsigned int whq : 2;                   //whichQueue
+} AStarStatus;
+
+/*What the last query did. The counters are always kept, as they cost an addition here and there;
+the phase times need the clock and are only measured when SearchState.timed is set. The output
+phase belongs to the caller, which fills output_time itself.*/
+typedef struct {
+    unsigned long relaxed;      //Edges looked at from expanded nodes
+    unsigned long decreased;    //Nodes of OPEN whose key went down
+    unsigned long peak_open;    //Largest size of OPEN (of both of them for the bidirectional searches)
+    unsigned long touched;      //Node states the query initialized
+    double init_time, search_time, rebuild_time, output_time;      //Seconds
+} SearchStats;
+
+/*Limits of WeightedAStar() and AnytimeAStar(). The path found is at most 1+epsilon times as long as
+the shortest one. The anytime search starts with epsilon and keeps lowering it down to 0 (the
+shortest path) until time_limit seconds or max_expanded expansions are spent (0 for no limit), but
+it always finishes its first path.*/
+typedef struct {
+    double epsilon;
+    double time_limit;
+    unsigned long max_expanded;
+} SuboptimalLimits;
+
+/*Search arrays, allocated once and reused by every query. Instead of resetting the nnodes entries
+of PathData before each search, every query gets a new generation number and an entry with an
+older gen is taken as untouched (NONE, g = INFINITY). A query only writes the nodes it reaches.*/
+typedef struct {
+    AStarStatus* PathData;
+    unsigned long nnodes;
+    unsigned int generation;
+    uint32_t* OpenPos;          //Heap positions of the nodes in OPEN, kept next to PathData
+    OpenHeap open_set;
+    //Backward half of BiAStar, allocated by its first call:
+    AStarStatus* PathDataRev;
+    uint32_t* OpenPosRev;
+    OpenHeap open_rev;
+    const CHGraph* ch;          //Hierarchy of the last search, if it was CHSearch
+    double distance;            //Length of the last path found, in km
+    double bound;               //The last path is at most bound times the shortest one (1 for the exact searches)
+    const Graph* recost;        //Graph to add up the path on again when its g can be stale (AnytimeAStar)
+    NodeIndex* closed;          //Nodes closed in the current round of AnytimeAStar, or settled by CHUpward (allocated on first use)
+    unsigned long closed_len, closed_cap;
+    unsigned long meet;         //Node where both halves of the path join (dest_index for AStar)
+    unsigned long* path;        //Last path rebuilt, from source to destination
+    double* path_g;             //Distance from the source to every node of path
+    double* arcs;               //Heuristic distances of the successors of the node being expanded
+    unsigned long arcs_cap;
+    NodeIndex* succ;            //Successors of the node being expanded, when the adjacency is packed
+    unsigned long succ_cap;
+    unsigned long path_len, path_cap;
+    unsigned long expanded_nodes_counter;
+    unsigned long expanded_backward;
+    bool timed;                 //Measure the phase times of stats
+    SearchStats stats;
+} SearchState;
+
+
+void search_init(SearchState* S, unsigned long nnodes);
+void search_free(SearchState* S);
+bool AStar (const Graph* graph, SearchState* S, unsigned long source_index, unsigned long dest_index);
+bool AStarALT (const Graph* graph, const Landmarks* lm, SearchState* S, unsigned long source_index, unsigned long dest_index);
+bool BiAStar (const Graph* graph, SearchState* S, unsigned long source_index, unsigned long dest_index);
+bool WeightedAStar (const Graph* graph, SearchState* S, unsigned long source_index, unsigned long dest_index, double epsilon);
+bool AnytimeAStar (const Graph* graph, SearchState* S, unsigned long source_index, unsigned long dest_index, const SuboptimalLimits* limits);
+bool CHSearch (const CHGraph* ch, SearchState* S, unsigned long source_index, unsigned long dest_index);
+bool OneToMany (const Graph* graph, SearchState* S, unsigned long source_index, const uint8_t* marks, unsigned long ntargets);
+unsigned long CHUpward (const CHGraph* ch, SearchState* S, unsigned long index, bool backward);
+double search_label(const SearchState* S, unsigned long index, bool backward);
+unsigned long rebuild_path(SearchState* S, unsigned long source_index, unsigned long dest_index);
+unsigned long tree_path(SearchState* S, unsigned long source_index, unsigned long target_index);
+
+#endif
@@ -0,0 +1,38 @@
+#!/bin/sh
+#A compaction that only changes a length keeps the sizes of the graph, but not its stamp: the .alt
+#and .ch files of the old graph must be ignored, and the log must keep its updates with a marker.
+#Run from a directory with the built tools: sh tests/compact_stamp.sh [bindir]
+set -e
+BIN=$(cd "${1:-.}" && pwd)
+DIR=$(mktemp -d)
+trap 'rm -rf "$DIR"' EXIT
+cd "$DIR"
+fail() { echo "FAIL: $1"; exit 1; }
+
+"$BIN/gen_map" -w 20 -s 3 map.csv > /dev/null
+"$BIN/write" map.csv > /dev/null
+"$BIN/write_alt" map.bin > /dev/null
+"$BIN/write_ch" map.bin > /dev/null
+
+#The first street of the first way, in both directions.
+set -- $(grep -m1 '^way' map.csv | cut -d'|' -f10,11 | tr '|' ' ')
+"$BIN/astar" map.bin "$1" "$2" c > before.txt 2> err.txt || fail "no route before the update"
+grep -q Ignoring err.txt && fail "fresh .alt or .ch ignored"
+printf 'weight %s %s 5000\nweight %s %s 5000\n' "$1" "$2" "$2" "$1" > map.upd
+"$BIN/astar" map.bin "$1" "$2" a 2> /dev/null | grep distance > updated.txt || fail "no route with the update"
+
+size=$(wc -c < map.bin)
+"$BIN/compact" map.bin > /dev/null 2>&1
+[ "$(wc -c < map.bin)" -eq "$size" ] || fail "the weight-only compaction changed the size of the file"
+grep -q '^merged ' map.upd || fail "no merged marker in the log"
+
+"$BIN/astar" map.bin "$1" "$2" a 2> err.txt | grep distance > compacted.txt || fail "no route after the compaction"
+[ "$(grep -c Ignoring err.txt)" -eq 2 ] || fail "the old .alt or .ch was accepted"
+cmp -s updated.txt compacted.txt || fail "the compacted graph routes differently from the log"
+"$BIN/astar" map.bin "$1" "$2" c > /dev/null 2>&1 && fail "mode c answered without a hierarchy"
+
+"$BIN/write_alt" map.bin > /dev/null
+"$BIN/write_ch" map.bin > /dev/null
+"$BIN/astar" map.bin "$1" "$2" c > /dev/null 2> err.txt || fail "no route with the new hierarchy"
+grep -q Ignoring err.txt && fail "new .alt or .ch ignored"
+echo "compact_stamp: ok"
@@ -1,237 +1,733 @@
-#include <stdio.h>
-#include <stdlib.h>
-#include <string.h>
-#include <stdbool.h>
-#include <math.h>
-#include <time.h>
-
-typedef struct {
-    unsigned long id;           
-    unsigned short namelen;    
-    char* name;                 
-    double lat, lon;            
-    unsigned short nsucc;       
-    unsigned long* successors;  
-} node;
-
-
-void ExitError(const char *miss, int errcode) {
-    fprintf (stderr, "\nERROR: %s.\nStopping...\n\n", miss); exit(errcode);
-}
-
-
-//Binary search function 
-signed long binary_search(node* nodes, unsigned long id, unsigned long low, unsigned long high) {
-    if ( nodes[low].id == id ) return (signed long)low;
-    if ( nodes[high].id == id ) return (signed long)high;
-    signed long index = (high + low)/2;
-    unsigned long guess = nodes[index].id;
-    while ( (high-low) > 1 ) {
-        if (guess == id) { return index; }
-        if (guess > id) { high = index; }
-        if (guess < id) { low = index; }
-        index = (high + low)/2;
-        guess = nodes[index].id;
-    }
-    return -1; 
-}
-
-
-//Updates information (total number of successors)
-void update_nsuccs(unsigned short* nsuccdim, char* line, node* nodes, unsigned long nnodes) {
-    bool oneway = false;                            
-    char* field = strsep(&line, "|");              
-    if (*field != 'w') return;                      
-    unsigned short count;
-    for (count = 2; count < 9; count++) field = strsep(&line, "|");                        
-    if (*field == 'o') oneway = true;                
-    field = strsep(&line, "|");                      
-    
-    char* ptr = NULL;                                
-    char* node_n = NULL;                             
-    char* node_m = NULL;                             
-    unsigned long id_n, id_m;                        
-    signed long n = -1, m;                           
-    while ((n == -1) && ((node_n = strsep(&line, "|")) != NULL)) { 
-        id_n = strtoul(node_n, &ptr, 10);
-        n = binary_search(nodes, id_n, 0, nnodes-1);
-    }
-    while ((node_m = strsep(&line, "|")) != NULL) {  
-        id_m = strtoul(node_m, &ptr, 10);
-        m = binary_search(nodes, id_m, 0, nnodes-1);
-        if (m == -1) continue;                       
-        if (oneway == true) nsuccdim[n] += 1;
-        else { nsuccdim[n] += 1; nsuccdim[m] += 1; }
-        n = m;                                       
-    }
-}
-
-
-//Updates information (adjacent nodes)
-void update_successors(char* line, node* nodes, unsigned long nnodes, unsigned short* counters) {
-    bool oneway = false;                            
-    char* field = strsep(&line, "|");               
-    if (*field != 'w') return;                      
-    unsigned short count;
-    for (count = 2; count < 9; count++) field = strsep(&line, "|");                      
-    if (*field == 'o') oneway = true;                
-    field = strsep(&line, "|");                      
-    
-    char* ptr = NULL;                                
-    char* node_n = NULL;                             
-    char* node_m = NULL;                             
-    unsigned long id_n, id_m;                        
-    signed long n = -1, m;                           
-    while ((n == -1) && ((node_n = strsep(&line, "|")) != NULL)) { 
-        id_n = strtoul(node_n, &ptr, 10);
-        n = binary_search(nodes, id_n, 0, nnodes-1);
-    }
-    unsigned short free_n, free_m;                   
-    while ((node_m = strsep(&line, "|")) != NULL) {  
-        id_m = strtoul(node_m, &ptr, 10);
-        m = binary_search(nodes, id_m, 0, nnodes-1);
-        if (m == -1) continue;                       
-        free_n = counters[n];                         
-        free_m = counters[m];                         
-        if (oneway == true) { (nodes[n].successors)[free_n] = m;  counters[n] += 1; } 
-        else {                                                                        
-            (nodes[n].successors)[free_n] = m;    counters[n] += 1;
-            (nodes[m].successors)[free_m] = n;    counters[m] += 1;
-        }
-        n = m;                                        
-    }
-}
-
-//Updates information (node)
-void get_node(node* nodes, char* line, unsigned long i) {
-    char* field = NULL;
-    field = strsep(&line, "|");                                             
-    if (*field != 'n') return;                                               
-    field = strsep(&line, "|");                                              
-    char* ptr = NULL;                                                        
-    nodes[i].id = strtoul(field, &ptr, 10);
-    field = strsep(&line, "|");                                              
-    nodes[i].namelen = strlen(field);
-    if ((nodes[i].name = (char*) malloc(nodes[i].namelen + 1)) == NULL) ExitError("when allocating memory for a node name", 1);
-    strcpy( nodes[i].name, field );
-    unsigned short count;
-    for (count = 4; count < 11; count++) field = strsep(&line, "|");         
-    nodes[i].lat = atof(field);
-    field = strsep(&line, "|");                                              
-    nodes[i].lon = atof(field);
-}
-
-
-
-int main (int argc, char *argv[]) {
-    
-   FILE *fmap;
-    if ((fmap = fopen(argv[1], "r")) == NULL) ExitError("when opening the csv file", 2);
-    
-
-    char* line_buf = NULL;      
-    size_t line_buf_size = 0;   
-    ssize_t line_size = 0;      
-    
-    unsigned long nnodes = 0UL;
-    while (line_size >= 0) {
-        line_size = getline(&line_buf, &line_buf_size, fmap);
-        if (*(line_buf) == '#') continue;                    
-        else if (*(line_buf) == 'n') nnodes += 1;           
-        else if (*(line_buf) == 'w') break;                               
-    }
-    
-    node *nodes;
-    if((nodes = (node *) malloc(nnodes*sizeof(node))) == NULL) ExitError("when allocating memory for the nodes vector", 3);
-    unsigned long i = 0;  
-    unsigned short* nsuccdim = NULL;
-    if ((nsuccdim = (unsigned short*) calloc(nnodes, sizeof(unsigned short))) == NULL) ExitError("when allocating memory for nsuccdim", 4);
-        
-    fseek(fmap, 0, SEEK_SET);                                
-    while (line_size >= 0) {
-        line_size = getline(&line_buf, &line_buf_size, fmap);
-        if (*(line_buf) == '#') continue;                
-        else if (*(line_buf) == 'n') {                   
-            get_node(nodes, line_buf, i);                
-            i += 1;
-            continue;
-        }
-        else if (*(line_buf) == 'w') {                        
-            update_nsuccs(nsuccdim, line_buf, nodes, nnodes); 
-            continue;
-        }
-        else if (*(line_buf) == 'r') break;                                   
-    }
-    
-    for (i = 0; i < nnodes; i++) {
-        nodes[i].nsucc = nsuccdim[i];
-        if((nodes[i].successors = (unsigned long*) malloc(nsuccdim[i]*sizeof(unsigned long))) == NULL) ExitError("when allocating memory for the nodes successors", 5);
-    }
-    
-    unsigned short* succ_counter = NULL;
-    if((succ_counter = (unsigned short*) calloc(nnodes, sizeof(unsigned short))) == NULL) ExitError("when allocating memory for the nodes successor counters", 6);
-    
-    fseek(fmap, 0, SEEK_SET);                                      
-    while (line_size >= 0) {
-        line_size = getline(&line_buf, &line_buf_size, fmap);      
-        if (*(line_buf) == '#' || *(line_buf) == 'n') continue;    
-        if (*(line_buf) == 'w') {                                  
-            update_successors(line_buf, nodes, nnodes, succ_counter);                                                   
-        }
-        if (*(line_buf) == 'r') break;                              
-    }
-    free(succ_counter);     
-    free(line_buf);         
-    fclose(fmap);          
-    
-    FILE *fin;
-    char name[257];
-    
-    unsigned long ntotnsucc = 0UL;
-    unsigned long totnamelen = 0UL;
-    for(i = 0; i < nnodes; i++) {
-        ntotnsucc += nodes[i].nsucc;
-        totnamelen += nodes[i].namelen;
-    }
-    totnamelen += 1;
-    
-    char* allnames;
-    if((allnames = (char*) malloc((totnamelen)*sizeof(char))) == NULL) ExitError("when allocating memory for allnames vector", 7);
-    
-    strcpy(name, argv[1]); strcpy(strrchr(name, '.'), ".bin");
-    if ((fin = fopen (name, "wb")) == NULL)
-        ExitError("the output binary data file cannot be opened", 8);
-    
-    if( fwrite(&nnodes, sizeof(unsigned long), 1, fin) +
-        fwrite(&ntotnsucc, sizeof(unsigned long), 1, fin) +
-        fwrite(&totnamelen, sizeof(unsigned long), 1, fin) != 3 )
-            ExitError("when initializing the output binary data file", 9);
-
-    if( fwrite(nodes, sizeof(node), nnodes, fin) != nnodes )
-        ExitError("when writing nodes to the output binary data file", 10);
-       
-    for(i = 0; i < nnodes; i++){
-        if(nodes[i].nsucc) {
-            if ( fwrite(nodes[i].successors, sizeof(unsigned long), nodes[i].nsucc, fin) != nodes[i].nsucc )
-                ExitError("when writing edges to the output binary data file", 11);
-        }
-        strcat(allnames, nodes[i].name);
-    }
-    
-    if ( fwrite(allnames, sizeof(char), totnamelen, fin) != totnamelen )
-            ExitError("when writing allnames to the output binary data file", 12);
-        
-    fclose(fin);            
-                  
-    for (i = 0; i < nnodes; i++) { free(nodes[i].name); free(nodes[i].successors); }
-    free(nodes);
-    free(nsuccdim);
-    free(allnames);
-    
-    return 0;
-}
-
-
-
-
-
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "graph.h"
+#include "grid.h"
+
+/*The csv file is mapped in memory and cut into line-aligned chunks that worker threads parse in a
+single pass. Node lines become node records (their names are not copied, they point into the
+mapping) and way lines are kept as lists of node ids. Once all the nodes are known, the ids of
+every way are resolved into edges and the edges are turned into the CSR adjacency with a stable
+two-level counting sort. Every step keeps the order of the file, so the output is the same
+whatever the number of threads.
+
+By default the nodes are not numbered in file (OSM id) order but along a Hilbert curve over their
+coordinates, so that nodes close on the map are close in memory too: the successors a search
+relaxes, and their search state, then tend to share cache lines and pages. The ids stay in the ids
+array and the id index, so queries and outputs still use OSM ids.*/
+
+//Chunks per thread, so that a slow chunk does not leave the other threads idle:
+#define CHUNKS_PER_THREAD 4
+//Maximum number of node ranges (buckets) used by the first level of the counting sort:
+#define MAX_BUCKETS 16384
+//Bits of each coordinate on the Hilbert curve, and of the digits of the radix sort of the curve keys:
+#define HILBERT_BITS 16
+#define RADIX_BITS 16
+
+
+typedef struct {
+    unsigned long id;
+    double lat, lon;
+    const char* name;
+    unsigned long namelen;
+} NodeRec;
+
+typedef struct {
+    unsigned long first;        //Index of its first node id in the chunk's refs
+    unsigned long nrefs;
+    bool oneway;
+} WayRec;
+
+typedef struct {
+    NodeIndex from, to;
+} Edge;
+
+//Edge of the reverse adjacency, with the index of its forward twin to copy the length from.
+typedef struct {
+    NodeIndex to, from;
+    unsigned long e;
+} RevEdge;
+
+typedef struct {
+    const char* begin;          //Both line aligned
+    const char* end;
+    NodeRec* nodes;
+    unsigned long nnodes, capnodes;
+    WayRec* ways;
+    unsigned long nways, capways;
+    unsigned long* refs;
+    unsigned long nrefs, caprefs;
+    Edge* edges;
+    unsigned long nedges, capedges;
+    unsigned long noneway;      //Edges that come from one-way streets
+    bool relation;              //A relation line was found: the chunk (and the node and way sections) end there
+    unsigned long node_base;    //Index of the chunk's first node in the whole graph
+    double minlat, maxlat, minlon, maxlon;
+} Chunk;
+
+//Everything the parallel steps share:
+typedef struct {
+    Chunk* chunks;
+    unsigned long nchunks;
+    unsigned long nnodes, nedges;
+    uint64_t* ids;
+    GraphCoord* coords;
+    UnitVec* unitvecs;
+    uint64_t* offsets;
+    NodeIndex* targets;
+    uint64_t* name_offsets;
+    char* allnames;
+    double* lengths;
+    IdIndex ix;
+    NodeIndex* idslots;
+    unsigned long nregions;
+    unsigned long* rhist;       //nchunks x nregions write positions
+    unsigned long* region_start;
+    unsigned long nbuckets;
+    int shift;                  //Bucket of node v is v >> shift
+    unsigned long* hist;        //nchunks x nbuckets write positions
+    unsigned long* bucket_start;
+    Edge* sorted;
+    unsigned long* cursor;
+    uint64_t* rev_offsets;
+    NodeIndex* rev_sources;
+    double* rev_lengths;
+    RevEdge* rev_sorted;
+    double minlat, minlon, latscale, lonscale;
+    uint32_t* hkeys;            //Hilbert key of every node, in file order
+    unsigned long* perm;        //New index of every node, in file order
+    unsigned long* order;       //Node in file order of every new index
+    unsigned long* rhist_keys;  //nchunks x 2^RADIX_BITS write positions
+    int digit;                  //Radix sort pass
+} Converter;
+
+
+void ExitError(const char *miss, int errcode) {
+    fprintf (stderr, "\nERROR: %s.\nStopping...\n\n", miss); exit(errcode);
+}
+
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+
+typedef void (*TaskFn)(Converter* conv, unsigned long task);
+
+typedef struct {
+    TaskFn fn;
+    Converter* conv;
+    unsigned long ntasks;
+    unsigned long next;
+} Pool;
+
+static void* pool_worker(void* arg) {
+    Pool* pool = (Pool*) arg;
+    unsigned long task;
+    while ((task = __atomic_fetch_add(&pool->next, 1, __ATOMIC_RELAXED)) < pool->ntasks) pool->fn(pool->conv, task);
+    return NULL;
+}
+
+//Runs fn(conv, 0 .. ntasks-1) on nthreads threads (the calling one included) and waits for all of them.
+static void run_parallel(int nthreads, unsigned long ntasks, TaskFn fn, Converter* conv) {
+    Pool pool = {fn, conv, ntasks, 0};
+    pthread_t threads[nthreads];
+    int t;
+    for (t = 1; t < nthreads; t++)
+        if (pthread_create(&threads[t], NULL, pool_worker, &pool) != 0) ExitError("when creating a worker thread", 14);
+    pool_worker(&pool);
+    for (t = 1; t < nthreads; t++) pthread_join(threads[t], NULL);
+}
+
+
+//Doubles the capacity of a growable array when it is full.
+static void* grow(void* array, unsigned long count, unsigned long* cap, size_t elemsize) {
+    if (count < *cap) return array;
+    *cap = (*cap) ? 2*(*cap) : 1024;
+    if ((array = realloc(array, (*cap)*elemsize)) == NULL) ExitError("when allocating memory while parsing the csv file", 3);
+    return array;
+}
+
+
+//Returns the end of the field starting at p: the next '|' or the end of the line.
+static const char* field_end(const char* p, const char* eol) {
+    const char* q = (const char*) memchr(p, '|', eol - p);
+    return q ? q : eol;
+}
+
+//Moves p to the start of the next field. Returns false if the line has no more fields.
+static bool next_field(const char** p, const char* eol) {
+    const char* q = field_end(*p, eol);
+    if (q == eol) return false;
+    *p = q + 1;
+    return true;
+}
+
+//strtoul() on a field that is not NUL terminated.
+static unsigned long field_ulong(const char* p, const char* end) {
+    unsigned long v = 0;
+    while (p < end && (*p == ' ' || *p == '\t')) p++;
+    while (p < end && *p >= '0' && *p <= '9') v = 10*v + (unsigned long)(*p++ - '0');
+    return v;
+}
+
+//atof() on a field that is not NUL terminated.
+static double field_double(const char* p, const char* end) {
+    char buf[64];
+    size_t len = (size_t)(end - p);
+    if (len > sizeof(buf) - 1) len = sizeof(buf) - 1;
+    memcpy(buf, p, len);
+    buf[len] = '\0';
+    return atof(buf);
+}
+
+
+//Updates information (node): node|id|name|...|lat|lon
+static void get_node(Chunk* c, const char* line, const char* eol) {
+    c->nodes = (NodeRec*) grow(c->nodes, c->nnodes, &c->capnodes, sizeof(NodeRec));
+    NodeRec* nd = &c->nodes[c->nnodes++];
+    memset(nd, 0, sizeof(NodeRec));
+    const char* field = line;
+    if (!next_field(&field, eol)) return;
+    nd->id = field_ulong(field, field_end(field, eol));
+    if (!next_field(&field, eol)) return;
+    nd->name = field;
+    nd->namelen = (unsigned long)(field_end(field, eol) - field);
+    unsigned short count;
+    for (count = 4; count < 11; count++) if (!next_field(&field, eol)) return;
+    nd->lat = field_double(field, field_end(field, eol));
+    if (!next_field(&field, eol)) return;
+    nd->lon = field_double(field, field_end(field, eol));
+}
+
+//Keeps the ids of a way: way|id|...|oneway|maxspeed|node ids...
+static void get_way(Chunk* c, const char* line, const char* eol) {
+    const char* field = line;
+    unsigned short count;
+    for (count = 2; count < 9; count++) if (!next_field(&field, eol)) return;
+    bool oneway = (*field == 'o');
+    if (!next_field(&field, eol)) return;
+
+    c->ways = (WayRec*) grow(c->ways, c->nways, &c->capways, sizeof(WayRec));
+    WayRec* way = &c->ways[c->nways++];
+    way->first = c->nrefs;
+    way->oneway = oneway;
+    while (next_field(&field, eol)) {
+        c->refs = (unsigned long*) grow(c->refs, c->nrefs, &c->caprefs, sizeof(unsigned long));
+        c->refs[c->nrefs++] = field_ulong(field, field_end(field, eol));
+    }
+    way->nrefs = c->nrefs - way->first;
+}
+
+static void parse_chunk(Converter* conv, unsigned long task) {
+    Chunk* c = &conv->chunks[task];
+    const char* line = c->begin;
+    while (line < c->end) {
+        const char* eol = (const char*) memchr(line, '\n', c->end - line);
+        if (eol == NULL) eol = c->end;
+        if (*line == 'n') get_node(c, line, eol);
+        else if (*line == 'w') get_way(c, line, eol);
+        else if (*line == 'r') { c->relation = true; break; }
+        line = eol + 1;
+    }
+}
+
+
+/*Hilbert curve index of the cell (x, y) of a 2^HILBERT_BITS x 2^HILBERT_BITS grid: the curve
+visits the four quadrants one after the other, each one with a curve rotated to join the next.*/
+static uint32_t hilbert_key(uint32_t x, uint32_t y) {
+    uint32_t s, rx, ry, t, n = 1u << HILBERT_BITS;
+    uint64_t d = 0;
+    for (s = n / 2; s > 0; s /= 2) {
+        rx = (x & s) > 0;
+        ry = (y & s) > 0;
+        d += (uint64_t)s * s * ((3 * rx) ^ ry);
+        if (ry == 0) {
+            if (rx == 1) { x = n - 1 - x; y = n - 1 - y; }
+            t = x; x = y; y = t;
+        }
+    }
+    return (uint32_t)d;
+}
+
+static void chunk_bounds(Converter* conv, unsigned long task) {
+    Chunk* c = &conv->chunks[task];
+    unsigned long i;
+    c->minlat = c->minlon = INFINITY;
+    c->maxlat = c->maxlon = -INFINITY;
+    for (i = 0; i < c->nnodes; i++) {
+        if (c->nodes[i].lat < c->minlat) c->minlat = c->nodes[i].lat;
+        if (c->nodes[i].lat > c->maxlat) c->maxlat = c->nodes[i].lat;
+        if (c->nodes[i].lon < c->minlon) c->minlon = c->nodes[i].lon;
+        if (c->nodes[i].lon > c->maxlon) c->maxlon = c->nodes[i].lon;
+    }
+}
+
+static void compute_keys(Converter* conv, unsigned long task) {
+    Chunk* c = &conv->chunks[task];
+    unsigned long i;
+    double cells = (double)((1u << HILBERT_BITS) - 1);
+    for (i = 0; i < c->nnodes; i++) {
+        double x = (c->nodes[i].lon - conv->minlon) * conv->lonscale;
+        double y = (c->nodes[i].lat - conv->minlat) * conv->latscale;
+        uint32_t cx = (x > 0) ? (uint32_t)((x < cells) ? x : cells) : 0;
+        uint32_t cy = (y > 0) ? (uint32_t)((y < cells) ? y : cells) : 0;
+        conv->hkeys[c->node_base + i] = hilbert_key(cx, cy);
+        conv->order[c->node_base + i] = c->node_base + i;
+    }
+}
+
+/*LSD radix sort of the nodes by Hilbert key, RADIX_BITS per pass. Every pass is a stable counting
+sort from order to cursor, with the nodes cut into nchunks ranges like the edges of the CSR.*/
+static void count_keys(Converter* conv, unsigned long task) {
+    unsigned long* hist = conv->rhist_keys + task*(1UL << RADIX_BITS);
+    unsigned long i;
+    for (i = conv->nnodes*task/conv->nchunks; i < conv->nnodes*(task+1)/conv->nchunks; i++)
+        hist[(conv->hkeys[conv->order[i]] >> conv->digit) & ((1u << RADIX_BITS) - 1)] += 1;
+}
+
+static void scatter_keys(Converter* conv, unsigned long task) {
+    unsigned long* pos = conv->rhist_keys + task*(1UL << RADIX_BITS);
+    unsigned long i;
+    for (i = conv->nnodes*task/conv->nchunks; i < conv->nnodes*(task+1)/conv->nchunks; i++)
+        conv->cursor[pos[(conv->hkeys[conv->order[i]] >> conv->digit) & ((1u << RADIX_BITS) - 1)]++] = conv->order[i];
+}
+
+static void invert_order(Converter* conv, unsigned long task) {
+    unsigned long i;
+    for (i = conv->nnodes*task/conv->nchunks; i < conv->nnodes*(task+1)/conv->nchunks; i++) conv->perm[conv->order[i]] = i;
+}
+
+//Numbers the nodes along the Hilbert curve: perm[file index] = new index. Uses cursor as scratch.
+static void hilbert_order(Converter* conv, int nthreads) {
+    unsigned long n = conv->nnodes, c, b, pos, count, nb = 1UL << RADIX_BITS;
+    if ((conv->hkeys = (uint32_t*) malloc(n*sizeof(uint32_t))) == NULL ||
+        (conv->order = (unsigned long*) malloc(n*sizeof(unsigned long))) == NULL ||
+        (conv->rhist_keys = (unsigned long*) malloc(conv->nchunks*nb*sizeof(unsigned long))) == NULL)
+            ExitError("when allocating memory for the node order", 5);
+    run_parallel(nthreads, conv->nchunks, chunk_bounds, conv);
+    double maxlat = -INFINITY, maxlon = -INFINITY;
+    conv->minlat = conv->minlon = INFINITY;
+    for (c = 0; c < conv->nchunks; c++) {
+        if (conv->chunks[c].nnodes == 0) continue;
+        if (conv->chunks[c].minlat < conv->minlat) conv->minlat = conv->chunks[c].minlat;
+        if (conv->chunks[c].maxlat > maxlat) maxlat = conv->chunks[c].maxlat;
+        if (conv->chunks[c].minlon < conv->minlon) conv->minlon = conv->chunks[c].minlon;
+        if (conv->chunks[c].maxlon > maxlon) maxlon = conv->chunks[c].maxlon;
+    }
+    conv->latscale = (maxlat > conv->minlat) ? ((1u << HILBERT_BITS) - 1) / (maxlat - conv->minlat) : 0;
+    conv->lonscale = (maxlon > conv->minlon) ? ((1u << HILBERT_BITS) - 1) / (maxlon - conv->minlon) : 0;
+    run_parallel(nthreads, conv->nchunks, compute_keys, conv);
+
+    for (conv->digit = 0; conv->digit < 32; conv->digit += RADIX_BITS) {
+        memset(conv->rhist_keys, 0, conv->nchunks*nb*sizeof(unsigned long));
+        run_parallel(nthreads, conv->nchunks, count_keys, conv);
+        for (b = 0, pos = 0; b < nb; b++)
+            for (c = 0; c < conv->nchunks; c++) {
+                count = conv->rhist_keys[c*nb + b];
+                conv->rhist_keys[c*nb + b] = pos;
+                pos += count;
+            }
+        run_parallel(nthreads, conv->nchunks, scatter_keys, conv);
+        unsigned long* t = conv->order; conv->order = conv->cursor; conv->cursor = t;
+    }
+    run_parallel(nthreads, conv->nchunks, invert_order, conv);
+    free(conv->order); conv->order = NULL;
+    free(conv->hkeys); conv->hkeys = NULL;
+    free(conv->rhist_keys); conv->rhist_keys = NULL;
+}
+
+
+//Copies the nodes of a chunk to the graph arrays, at their new index.
+static void place_nodes(Converter* conv, unsigned long task) {
+    Chunk* c = &conv->chunks[task];
+    unsigned long i, v;
+    for (i = 0; i < c->nnodes; i++) {
+        v = conv->perm[c->node_base + i];
+        if (fabs(c->nodes[i].lat) > 90 || fabs(c->nodes[i].lon) > 180) ExitError("a node has coordinates out of range", 4);
+        conv->ids[v] = c->nodes[i].id;
+        conv->coords[v].lat = (int32_t) lrint(c->nodes[i].lat * GRAPH_COORD_SCALE);
+        conv->coords[v].lon = (int32_t) lrint(c->nodes[i].lon * GRAPH_COORD_SCALE);
+        Coord d = graph_coord_of(conv->coords[v]);
+        conv->unitvecs[v] = geo_unitvec(d.lat, d.lon);
+        conv->name_offsets[v+1] = c->nodes[i].namelen;
+    }
+}
+
+static void place_names(Converter* conv, unsigned long task) {
+    Chunk* c = &conv->chunks[task];
+    unsigned long i;
+    for (i = 0; i < c->nnodes; i++)
+        memcpy(conv->allnames + conv->name_offsets[conv->perm[c->node_base + i]], c->nodes[i].name, c->nodes[i].namelen);
+}
+
+
+/*The id index is filled region by region (see idindex.h). The nodes of every chunk are first
+counted and copied, in order, to the list of their region, using the cursor array as scratch.*/
+static void count_regions(Converter* conv, unsigned long task) {
+    Chunk* c = &conv->chunks[task];
+    unsigned long* hist = conv->rhist + task*conv->nregions;
+    unsigned long i;
+    for (i = c->node_base; i < c->node_base + c->nnodes; i++) hist[idindex_region(&conv->ix, conv->ids[i])] += 1;
+}
+
+static void scatter_regions(Converter* conv, unsigned long task) {
+    Chunk* c = &conv->chunks[task];
+    unsigned long* pos = conv->rhist + task*conv->nregions;
+    unsigned long i;
+    for (i = c->node_base; i < c->node_base + c->nnodes; i++) conv->cursor[pos[idindex_region(&conv->ix, conv->ids[i])]++] = i;
+}
+
+static void fill_region(Converter* conv, unsigned long task) {
+    unsigned long k;
+    for (k = conv->region_start[task]; k < conv->region_start[task+1]; k++) idindex_insert(&conv->ix, conv->idslots, conv->cursor[k]);
+}
+
+
+static void add_edge(Chunk* c, unsigned long from, unsigned long to) {
+    c->edges = (Edge*) grow(c->edges, c->nedges, &c->capedges, sizeof(Edge));
+    c->edges[c->nedges].from = from;
+    c->edges[c->nedges].to = to;
+    c->nedges += 1;
+}
+
+/*Turns the ways of a chunk into edges between consecutive nodes of the way that are in the graph
+(ids that are not found are skipped). Two-way streets give an edge in each direction.*/
+static void resolve_ways(Converter* conv, unsigned long task) {
+    Chunk* c = &conv->chunks[task];
+    unsigned long w, k;
+    for (w = 0; w < c->nways; w++) {
+        const unsigned long* refs = c->refs + c->ways[w].first;
+        signed long n = -1, m;
+        for (k = 0; k < c->ways[w].nrefs; k++) {
+            m = idindex_find(&conv->ix, refs[k]);
+            if (m == -1) continue;
+            if (n != -1) {
+                add_edge(c, (unsigned long)n, (unsigned long)m);
+                if (!c->ways[w].oneway) add_edge(c, (unsigned long)m, (unsigned long)n);
+                else c->noneway += 1;
+            }
+            n = m;
+        }
+    }
+    free(c->refs); c->refs = NULL;
+    free(c->ways); c->ways = NULL;
+}
+
+
+/*First level of the counting sort: every chunk counts its edges per bucket of source nodes, and
+then copies them to their bucket of the sorted array. Chunks are laid out in file order inside a
+bucket, so the sort is stable.*/
+static void count_buckets(Converter* conv, unsigned long task) {
+    Chunk* c = &conv->chunks[task];
+    unsigned long* hist = conv->hist + task*conv->nbuckets;
+    unsigned long e;
+    for (e = 0; e < c->nedges; e++) hist[c->edges[e].from >> conv->shift] += 1;
+}
+
+static void scatter_buckets(Converter* conv, unsigned long task) {
+    Chunk* c = &conv->chunks[task];
+    unsigned long* pos = conv->hist + task*conv->nbuckets;
+    unsigned long e;
+    for (e = 0; e < c->nedges; e++) conv->sorted[pos[c->edges[e].from >> conv->shift]++] = c->edges[e];
+    free(c->edges); c->edges = NULL;
+}
+
+/*Second level: the edges of a bucket already sit where the CSR puts the successors of its nodes,
+so each bucket is sorted by source node independently of the others.*/
+static void sort_bucket(Converter* conv, unsigned long task) {
+    unsigned long lo = task << conv->shift;
+    unsigned long hi = (task + 1) << conv->shift;
+    if (hi > conv->nnodes) hi = conv->nnodes;
+    unsigned long start = conv->bucket_start[task], end = conv->bucket_start[task+1];
+    unsigned long v, e, pos = start, deg;
+    for (v = lo; v < hi; v++) conv->cursor[v] = 0;
+    for (e = start; e < end; e++) conv->cursor[conv->sorted[e].from] += 1;
+    for (v = lo; v < hi; v++) {
+        deg = conv->cursor[v];
+        conv->offsets[v] = conv->cursor[v] = pos;
+        pos += deg;
+    }
+    for (e = start; e < end; e++) conv->targets[conv->cursor[conv->sorted[e].from]++] = conv->sorted[e].to;
+}
+
+//The length of every edge, computed once here so that the search does not need to:
+static void compute_lengths(Converter* conv, unsigned long task) {
+    unsigned long lo = task << conv->shift;
+    unsigned long hi = (task + 1) << conv->shift;
+    if (hi > conv->nnodes) hi = conv->nnodes;
+    unsigned long v, e;
+    for (v = lo; v < hi; v++)
+        for (e = conv->offsets[v]; e < conv->offsets[v+1]; e++)
+            conv->lengths[e] = haversine(graph_coord_of(conv->coords[v]), graph_coord_of(conv->coords[conv->targets[e]]));
+}
+
+
+/*The reverse adjacency is sorted the same way, by target node. The forward CSR is cut into
+nchunks node ranges that are read in order, so the sources of every node end up in increasing
+order.*/
+static void count_rev_buckets(Converter* conv, unsigned long task) {
+    unsigned long* hist = conv->hist + task*conv->nbuckets;
+    unsigned long e;
+    for (e = conv->offsets[conv->nnodes*task/conv->nchunks]; e < conv->offsets[conv->nnodes*(task+1)/conv->nchunks]; e++)
+        hist[conv->targets[e] >> conv->shift] += 1;
+}
+
+static void scatter_rev_buckets(Converter* conv, unsigned long task) {
+    unsigned long* pos = conv->hist + task*conv->nbuckets;
+    unsigned long u, e;
+    for (u = conv->nnodes*task/conv->nchunks; u < conv->nnodes*(task+1)/conv->nchunks; u++)
+        for (e = conv->offsets[u]; e < conv->offsets[u+1]; e++) {
+            RevEdge* r = &conv->rev_sorted[pos[conv->targets[e] >> conv->shift]++];
+            r->to = conv->targets[e];
+            r->from = u;
+            r->e = e;
+        }
+}
+
+static void sort_rev_bucket(Converter* conv, unsigned long task) {
+    unsigned long lo = task << conv->shift;
+    unsigned long hi = (task + 1) << conv->shift;
+    if (hi > conv->nnodes) hi = conv->nnodes;
+    unsigned long start = conv->bucket_start[task], end = conv->bucket_start[task+1];
+    unsigned long v, e, k, pos = start, deg;
+    for (v = lo; v < hi; v++) conv->cursor[v] = 0;
+    for (e = start; e < end; e++) conv->cursor[conv->rev_sorted[e].to] += 1;
+    for (v = lo; v < hi; v++) {
+        deg = conv->cursor[v];
+        conv->rev_offsets[v] = conv->cursor[v] = pos;
+        pos += deg;
+    }
+    for (e = start; e < end; e++) {
+        k = conv->cursor[conv->rev_sorted[e].to]++;
+        conv->rev_sources[k] = conv->rev_sorted[e].from;
+        conv->rev_lengths[k] = conv->lengths[conv->rev_sorted[e].e];
+    }
+}
+
+//Runs the first level of a counting sort (count, prefix sums, scatter) with the given steps.
+static void bucket_pass(Converter* conv, int nthreads, TaskFn count_fn, TaskFn scatter_fn) {
+    unsigned long b, c, pos = 0, count;
+    memset(conv->hist, 0, conv->nchunks*conv->nbuckets*sizeof(unsigned long));
+    run_parallel(nthreads, conv->nchunks, count_fn, conv);
+    for (b = 0; b < conv->nbuckets; b++) {
+        conv->bucket_start[b] = pos;
+        for (c = 0; c < conv->nchunks; c++) {
+            count = conv->hist[c*conv->nbuckets + b];
+            conv->hist[c*conv->nbuckets + b] = pos;
+            pos += count;
+        }
+    }
+    conv->bucket_start[conv->nbuckets] = pos;
+    run_parallel(nthreads, conv->nchunks, scatter_fn, conv);
+}
+
+
+
+int main (int argc, char *argv[]) {
+
+    //-p digits stores the edge lengths as fixed-point numbers with that many decimal digits (of km) instead of floats.
+    //-t threads sets the number of worker threads (all the cores by default).
+    //-o file keeps the nodes in the order of the file instead of numbering them along a Hilbert curve.
+    //-z packs the adjacency instead of writing plain arrays: zigzag deltas of the targets bit-packed with one width per
+    //block of 8 nodes, after the varint lengths of the lists of the block (see graph.h).
+    int fixed_digits = -1;
+    int nthreads = (int) sysconf(_SC_NPROCESSORS_ONLN);
+    bool hilbert = true, packed = false;
+    int opt;
+    while ((opt = getopt(argc, argv, "p:t:o:z")) != -1) {
+        if (opt == 'p') fixed_digits = atoi(optarg);
+        else if (opt == 't') nthreads = atoi(optarg);
+        else if (opt == 'o' && strcmp(optarg, "file") == 0) hilbert = false;
+        else if (opt == 'o' && strcmp(optarg, "hilbert") == 0) hilbert = true;
+        else if (opt == 'z') packed = true;
+        else ExitError("usage: write [-p digits] [-t threads] [-o hilbert|file] [-z] map.csv", 1);
+    }
+    if (optind >= argc || fixed_digits > 9) ExitError("usage: write [-p digits] [-t threads] [-o hilbert|file] [-z] map.csv", 1);
+    if (nthreads < 1) nthreads = 1;
+    char* csvfile = argv[optind];
+
+    int fd;
+    struct stat st;
+    if ((fd = open(csvfile, O_RDONLY)) < 0 || fstat(fd, &st) < 0) ExitError("when opening the csv file", 2);
+    size_t filesize = (size_t) st.st_size;
+    const char* csv = (filesize > 0) ? (const char*) mmap(NULL, filesize, PROT_READ, MAP_PRIVATE, fd, 0) : NULL;
+    if (csv == MAP_FAILED) ExitError("when mapping the csv file", 2);
+    close(fd);
+    if (filesize > 0) madvise((void*)csv, filesize, MADV_SEQUENTIAL);
+
+    double t0 = now();
+    Converter conv;
+    memset(&conv, 0, sizeof(Converter));
+    conv.nchunks = (unsigned long)nthreads * CHUNKS_PER_THREAD;
+    if (conv.nchunks > filesize / 4096 + 1) conv.nchunks = filesize / 4096 + 1;
+    if ((conv.chunks = (Chunk*) calloc(conv.nchunks, sizeof(Chunk))) == NULL) ExitError("when allocating memory for the chunks", 3);
+    unsigned long c;
+    const char* cut = csv;
+    for (c = 0; c < conv.nchunks; c++) {
+        const char* end = csv + filesize * (c + 1) / conv.nchunks;
+        if (end < cut) end = cut;
+        if (c + 1 < conv.nchunks && end > csv) {
+            const char* eol = (const char*) memchr(end - 1, '\n', csv + filesize - (end - 1));
+            end = eol ? eol + 1 : csv + filesize;
+        }
+        conv.chunks[c].begin = cut;
+        conv.chunks[c].end = end;
+        cut = end;
+    }
+    run_parallel(nthreads, conv.nchunks, parse_chunk, &conv);
+    double t1 = now();
+
+    //Everything after the first relation is ignored:
+    for (c = 0; c < conv.nchunks; c++) if (conv.chunks[c].relation) break;
+    if (c < conv.nchunks) {
+        unsigned long d;
+        for (d = c + 1; d < conv.nchunks; d++) {
+            free(conv.chunks[d].nodes); free(conv.chunks[d].ways); free(conv.chunks[d].refs);
+        }
+        conv.nchunks = c + 1;
+    }
+
+    unsigned long nnodes = 0UL;
+    unsigned long totnamelen = 0UL;
+    for (c = 0; c < conv.nchunks; c++) {
+        conv.chunks[c].node_base = nnodes;
+        nnodes += conv.chunks[c].nnodes;
+    }
+    if (nnodes == 0) ExitError("the csv file has no nodes", 4);
+    if (nnodes > GRAPH_MAX_NODES) ExitError("the csv file has more nodes than a graph can index", 4);
+    conv.nnodes = nnodes;
+    if ((conv.ids = (uint64_t*) malloc(nnodes*sizeof(uint64_t))) == NULL ||
+        (conv.coords = (GraphCoord*) malloc(nnodes*sizeof(GraphCoord))) == NULL ||
+        (conv.unitvecs = (UnitVec*) malloc(nnodes*sizeof(UnitVec))) == NULL ||
+        (conv.offsets = (uint64_t*) malloc((nnodes+1)*sizeof(uint64_t))) == NULL ||
+        (conv.name_offsets = (uint64_t*) malloc((nnodes+1)*sizeof(uint64_t))) == NULL ||
+        (conv.cursor = (unsigned long*) malloc(nnodes*sizeof(unsigned long))) == NULL)
+            ExitError("when allocating memory for the nodes vectors", 5);
+    if ((conv.perm = (unsigned long*) malloc(nnodes*sizeof(unsigned long))) == NULL) ExitError("when allocating memory for the node order", 5);
+    unsigned long i;
+    if (hilbert) hilbert_order(&conv, nthreads);
+    else for (i = 0; i < nnodes; i++) conv.perm[i] = i;
+    run_parallel(nthreads, conv.nchunks, place_nodes, &conv);
+
+    conv.name_offsets[0] = 0;
+    for (i = 0; i < nnodes; i++) conv.name_offsets[i+1] += conv.name_offsets[i];
+    totnamelen = conv.name_offsets[nnodes];
+    if ((conv.allnames = (char*) malloc(totnamelen + 1)) == NULL) ExitError("when allocating memory for allnames vector", 7);
+    run_parallel(nthreads, conv.nchunks, place_names, &conv);
+    for (c = 0; c < conv.nchunks; c++) { free(conv.chunks[c].nodes); conv.chunks[c].nodes = NULL; }
+    free(conv.perm); conv.perm = NULL;
+
+    uint64_t nslots = idindex_nslots(nnodes);
+    if ((conv.idslots = (NodeIndex*) calloc(nslots, sizeof(NodeIndex))) == NULL) ExitError("when allocating memory for the id index", 5);
+    idindex_init(&conv.ix, conv.idslots, nslots, conv.ids);
+    conv.nregions = (nslots - 1) / (conv.ix.region_mask + 1) + 1;
+    if ((conv.rhist = (unsigned long*) calloc(conv.nchunks*conv.nregions, sizeof(unsigned long))) == NULL ||
+        (conv.region_start = (unsigned long*) malloc((conv.nregions+1)*sizeof(unsigned long))) == NULL)
+            ExitError("when allocating memory for the id index", 5);
+    run_parallel(nthreads, conv.nchunks, count_regions, &conv);
+    unsigned long r, rpos = 0, rcount;
+    for (r = 0; r < conv.nregions; r++) {
+        conv.region_start[r] = rpos;
+        for (c = 0; c < conv.nchunks; c++) {
+            rcount = conv.rhist[c*conv.nregions + r];
+            conv.rhist[c*conv.nregions + r] = rpos;
+            rpos += rcount;
+        }
+    }
+    conv.region_start[conv.nregions] = rpos;
+    run_parallel(nthreads, conv.nchunks, scatter_regions, &conv);
+    run_parallel(nthreads, conv.nregions, fill_region, &conv);
+
+    run_parallel(nthreads, conv.nchunks, resolve_ways, &conv);
+
+    unsigned long ntotnsucc = 0UL, noneway = 0UL;
+    for (c = 0; c < conv.nchunks; c++) {
+        ntotnsucc += conv.chunks[c].nedges;
+        noneway += conv.chunks[c].noneway;
+    }
+    conv.nedges = ntotnsucc;
+    while (((nnodes - 1) >> conv.shift) >= MAX_BUCKETS) conv.shift += 1;
+    conv.nbuckets = ((nnodes - 1) >> conv.shift) + 1;
+    if ((conv.hist = (unsigned long*) calloc(conv.nchunks*conv.nbuckets, sizeof(unsigned long))) == NULL ||
+        (conv.bucket_start = (unsigned long*) malloc((conv.nbuckets+1)*sizeof(unsigned long))) == NULL ||
+        (conv.sorted = (Edge*) malloc((ntotnsucc+1)*sizeof(Edge))) == NULL ||
+        (conv.targets = (NodeIndex*) malloc((ntotnsucc+1)*sizeof(NodeIndex))) == NULL ||
+        (conv.lengths = (double*) malloc((ntotnsucc+1)*sizeof(double))) == NULL)
+            ExitError("when allocating memory for the successors", 6);
+    bucket_pass(&conv, nthreads, count_buckets, scatter_buckets);
+    run_parallel(nthreads, conv.nbuckets, sort_bucket, &conv);
+    conv.offsets[nnodes] = ntotnsucc;
+    run_parallel(nthreads, conv.nbuckets, compute_lengths, &conv);
+    free(conv.sorted); conv.sorted = NULL;
+
+    //Without one-way streets the graph is its own reverse and the router uses the forward arrays.
+    if (noneway > 0) {
+        if ((conv.rev_offsets = (uint64_t*) malloc((nnodes+1)*sizeof(uint64_t))) == NULL ||
+            (conv.rev_sources = (NodeIndex*) malloc((ntotnsucc+1)*sizeof(NodeIndex))) == NULL ||
+            (conv.rev_lengths = (double*) malloc((ntotnsucc+1)*sizeof(double))) == NULL ||
+            (conv.rev_sorted = (RevEdge*) malloc((ntotnsucc+1)*sizeof(RevEdge))) == NULL)
+                ExitError("when allocating memory for the reverse adjacency", 6);
+        bucket_pass(&conv, nthreads, count_rev_buckets, scatter_rev_buckets);
+        run_parallel(nthreads, conv.nbuckets, sort_rev_bucket, &conv);
+        conv.rev_offsets[nnodes] = ntotnsucc;
+        free(conv.rev_sorted); conv.rev_sorted = NULL;
+    }
+    GraphGrid grid;
+    uint32_t* grid_cells;
+    NodeIndex* grid_nodes;
+    grid_build(conv.coords, conv.offsets, nnodes, &grid, &grid_cells, &grid_nodes);
+    double t2 = now();
+
+    char name[257];
+    strcpy(name, csvfile); strcpy(strrchr(name, '.'), ".bin");
+    GraphWriter gw;
+    graph_writer_open(&gw, name, nnodes, ntotnsucc);
+    gw.hdr.grid = grid;
+    graph_write_section(&gw, SEC_IDS, conv.ids, nnodes*sizeof(uint64_t));
+    graph_write_section(&gw, SEC_COORDS, conv.coords, nnodes*sizeof(GraphCoord));
+    graph_write_section(&gw, SEC_UNITVEC, conv.unitvecs, nnodes*sizeof(UnitVec));
+    graph_write_adjacency(&gw, false, conv.offsets, conv.targets, packed);
+    graph_write_section(&gw, SEC_NAME_OFFSETS, conv.name_offsets, (nnodes+1)*sizeof(uint64_t));
+    graph_write_section(&gw, SEC_NAMES, conv.allnames, totnamelen);
+    graph_write_metric(&gw, 0, METRIC_DISTANCE, conv.lengths, fixed_digits);
+    graph_write_section(&gw, SEC_IDINDEX, conv.idslots, nslots*sizeof(NodeIndex));
+    if (noneway > 0) {
+        graph_write_adjacency(&gw, true, conv.rev_offsets, conv.rev_sources, packed);
+        graph_write_weights(&gw, SEC_REV_WEIGHTS, conv.rev_lengths, (int)gw.hdr.metric[0].encoding, gw.hdr.metric[0].scale);
+    }
+    graph_write_section(&gw, SEC_GRID_CELLS, grid_cells, (2*(uint64_t)grid.rows*grid.cols + 1)*sizeof(uint32_t));
+    graph_write_section(&gw, SEC_GRID_NODES, grid_nodes, nnodes*sizeof(NodeIndex));
+    graph_writer_close(&gw);
+    double t3 = now();
+
+    printf("%lu nodes, %lu edges (%lu one-way).\n", nnodes, ntotnsucc, noneway);
+    if (packed) {
+        uint64_t plain = (nnodes+1)*sizeof(uint64_t) + ntotnsucc*sizeof(NodeIndex);
+        uint64_t size = gw.hdr.section[SEC_BLOCKS].size + gw.hdr.section[SEC_PACKED].size;
+        printf("Packed adjacency: %.1f MB instead of %.1f MB (%.2f bytes per edge).\n", size/1e6, plain/1e6, (double)size / (ntotnsucc ? ntotnsucc : 1));
+    }
+    printf("Parsed %.1f MB in %.3f seconds (%.1f MB/s, %d threads).\n", filesize/1e6, t1 - t0, filesize/1e6/(t1 - t0), nthreads);
+    printf("Adjacency and spatial grid built in %.3f seconds, binary file written in %.3f seconds.\n", t2 - t1, t3 - t2);
+
+    for (c = 0; c < conv.nchunks; c++) free(conv.chunks[c].edges);
+    free(conv.chunks);
+    free(conv.ids); free(conv.coords); free(conv.unitvecs); free(conv.offsets); free(conv.targets); free(conv.name_offsets);
+    free(conv.allnames); free(conv.lengths); free(conv.hist); free(conv.bucket_start); free(conv.cursor);
+    free(conv.rev_offsets); free(conv.rev_sources); free(conv.rev_lengths);
+    free(conv.idslots); free(conv.rhist); free(conv.region_start);
+    free(grid_cells); free(grid_nodes);
+    if (filesize > 0) munmap((void*)csv, filesize);
+
+    return 0;
+}
@@ -0,0 +1,206 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "graph.h"
+#include "heap.h"
+#include "landmarks.h"
+
+/*Landmark preprocessing for the ALT heuristic (see landmarks.h): reads map.bin and writes map.alt.
+
+The landmarks are chosen by farthest-point selection: the first one is the node farthest from
+node 0 and every next one is the node farthest from all the landmarks chosen so far, so they end
+up spread around the edges of the map, where their bounds are the tightest. Every landmark needs a
+Dijkstra search over the whole graph in each direction. The forward ones are needed to choose the
+next landmark and run one after the other; the backward ones run in parallel afterwards.*/
+
+
+void ExitError(const char *miss, int errcode) {
+    fprintf (stderr, "\nERROR: %s.\nStopping...\n\n", miss); exit(errcode);
+}
+
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+
+//Work arrays of one Dijkstra search.
+typedef struct {
+    double* dist;
+    uint32_t* pos;
+    NodeIndex* succ;            //Successors of the node being settled, when the adjacency is packed
+    OpenHeap heap;
+} Dijkstra;
+
+static void dijkstra_init(Dijkstra* d, const Graph* g) {
+    if ((d->dist = (double*) malloc(g->nnodes*sizeof(double))) == NULL ||
+        (d->pos = (uint32_t*) malloc(g->nnodes*sizeof(uint32_t))) == NULL ||
+        (d->succ = (NodeIndex*) malloc((g->max_degree + 1)*sizeof(NodeIndex))) == NULL)
+            ExitError("when allocating memory for the Dijkstra search", 3);
+    heap_init(&d->heap, 1024, d->pos);
+}
+
+static void dijkstra_free(Dijkstra* d) {
+    heap_free(&d->heap);
+    free(d->dist);
+    free(d->pos);
+    free(d->succ);
+}
+
+/*Distances from source to every node (backward = false) or from every node to source (backward =
+true, on the reverse adjacency), INFINITY for the nodes that cannot be reached. As the weights are
+not negative, a node can only improve while it is still in the heap.*/
+static void dijkstra_run(const Graph* g, Dijkstra* d, unsigned long source, bool backward) {
+    const void* weights     = backward ? g->rev_weights : g->weights;
+    const NodeIndex* targets;
+    unsigned long i, k, n, first, u, v;
+    double nd;
+    for (i = 0; i < g->nnodes; i++) d->dist[i] = INFINITY;
+    d->heap.size = 0;
+    d->dist[source] = 0;
+    heap_push(&d->heap, source, 0);
+    while (!heap_empty(&d->heap)) {
+        u = heap_pop(&d->heap);
+        n = graph_adjacent(g, backward, u, d->succ, &targets, &first);
+        for (k = 0; k < n; k++) {
+            v = targets[k];
+            nd = d->dist[u] + graph_weight_of(g, weights, first + k);
+            if (nd >= d->dist[v]) continue;
+            if (d->dist[v] == INFINITY) heap_push(&d->heap, v, nd);
+            else heap_decrease(&d->heap, v, nd);
+            d->dist[v] = nd;
+        }
+    }
+}
+
+//Copies the distances of a search into column col of the table.
+static void store_column(float* table, unsigned long nnodes, unsigned int width, unsigned int col, const double* dist) {
+    unsigned long v;
+    for (v = 0; v < nnodes; v++) table[v*width + col] = (float)dist[v];
+}
+
+
+typedef struct {
+    const Graph* g;
+    const uint64_t* landmarks;
+    unsigned int k;
+    float* table;
+    unsigned int next;
+} BackwardPool;
+
+static void* backward_worker(void* arg) {
+    BackwardPool* pool = (BackwardPool*) arg;
+    Dijkstra d;
+    unsigned int i;
+    dijkstra_init(&d, pool->g);
+    while ((i = __atomic_fetch_add(&pool->next, 1, __ATOMIC_RELAXED)) < pool->k) {
+        dijkstra_run(pool->g, &d, pool->landmarks[i], true);
+        store_column(pool->table, pool->g->nnodes, 2*pool->k, pool->k + i, d.dist);
+    }
+    dijkstra_free(&d);
+    return NULL;
+}
+
+
+int main (int argc, char *argv[]) {
+
+    //-k landmarks sets the number of landmarks (16 by default): every landmark costs 8 bytes per node.
+    //-t threads sets the number of worker threads (all the cores by default).
+    unsigned int k = 16;
+    int nthreads = (int) sysconf(_SC_NPROCESSORS_ONLN);
+    int opt;
+    while ((opt = getopt(argc, argv, "k:t:")) != -1) {
+        if (opt == 'k') k = (unsigned int) atoi(optarg);
+        else if (opt == 't') nthreads = atoi(optarg);
+        else ExitError("usage: write_alt [-k landmarks] [-t threads] map.bin", 1);
+    }
+    if (optind >= argc || k < 1 || k > ALT_MAX) ExitError("usage: write_alt [-k landmarks (1 to 64)] [-t threads] map.bin", 1);
+    if (nthreads < 1) nthreads = 1;
+    char* binfile = argv[optind];
+
+    Graph graph;
+    const char* err;
+    if ((err = graph_open(&graph, binfile)) != NULL) ExitError(err, 8);
+    unsigned long n = graph.nnodes, v;
+    if (n == 0) ExitError("the graph has no nodes", 8);
+    if (k > n) k = (unsigned int) n;
+
+    double t0 = now();
+    uint64_t landmarks[ALT_MAX];
+    float* table;
+    double* mindist;
+    if ((table = (float*) malloc(n*2*k*sizeof(float))) == NULL ||
+        (mindist = (double*) malloc(n*sizeof(double))) == NULL) ExitError("when allocating memory for the landmark table", 3);
+    for (v = 0; v < n; v++) mindist[v] = INFINITY;
+
+    //Farthest-point selection. A node that no landmark reaches yet is not a candidate: it may be in another component.
+    Dijkstra d;
+    dijkstra_init(&d, &graph);
+    dijkstra_run(&graph, &d, 0, false);
+    unsigned int i;
+    for (i = 0; i < k; i++) {
+        unsigned long best = n;
+        double far = -1;
+        for (v = 0; v < n; v++) {
+            double dv = (i == 0) ? d.dist[v] : mindist[v];
+            if (dv < INFINITY && dv > far) { far = dv; best = v; }
+        }
+        if (best == n || (i > 0 && far == 0)) break;
+        landmarks[i] = best;
+        dijkstra_run(&graph, &d, best, false);
+        for (v = 0; v < n; v++) if (d.dist[v] < mindist[v]) mindist[v] = d.dist[v];
+        store_column(table, n, 2*k, i, d.dist);
+    }
+    dijkstra_free(&d);
+    free(mindist);
+    if (i < k) {
+        //Fewer distinct landmarks than asked for (a tiny graph): close the gaps of the table.
+        unsigned int j;
+        for (v = 0; v < n; v++) for (j = 0; j < i; j++) table[v*2*i + j] = table[v*2*k + j];
+        k = i;
+    }
+    double t1 = now();
+
+    BackwardPool pool = {&graph, landmarks, k, table, 0};
+    pthread_t threads[nthreads];
+    int t;
+    for (t = 1; t < nthreads; t++)
+        if (pthread_create(&threads[t], NULL, backward_worker, &pool) != 0) ExitError("when creating a worker thread", 14);
+    backward_worker(&pool);
+    for (t = 1; t < nthreads; t++) pthread_join(threads[t], NULL);
+    double t2 = now();
+
+    char name[4096];
+    graph_sidecar_path(binfile, ".alt", name, sizeof(name));
+    FILE* fout;
+    if ((fout = fopen(name, "wb")) == NULL) ExitError("the landmark file cannot be opened", 8);
+    AltHeader hdr;
+    memset(&hdr, 0, sizeof(AltHeader));
+    memcpy(hdr.magic, ALT_MAGIC, sizeof(hdr.magic));
+    hdr.endian = GRAPH_ENDIAN_TAG;
+    hdr.version = ALT_VERSION;
+    hdr.nnodes = n;
+    hdr.stamp = graph_stamp(&graph);
+    hdr.nlandmarks = k;
+    hdr.table_offset = (sizeof(AltHeader) + k*sizeof(uint64_t) + GRAPH_ALIGN - 1) & ~(uint64_t)(GRAPH_ALIGN - 1);
+    static const char zeros[GRAPH_ALIGN];
+    size_t pad = hdr.table_offset - sizeof(AltHeader) - k*sizeof(uint64_t);
+    if (fwrite(&hdr, sizeof(AltHeader), 1, fout) != 1 || fwrite(landmarks, sizeof(uint64_t), k, fout) != k ||
+        fwrite(zeros, 1, pad, fout) != pad || fwrite(table, 2*k*sizeof(float), n, fout) != n)
+            ExitError("when writing to the landmark file", 10);
+    if (fclose(fout) != 0) ExitError("when closing the landmark file", 11);
+
+    printf("%u landmarks for %lu nodes, %.1f MB of distances in %s.\n", k, n, n*2.0*k*sizeof(float)/1e6, name);
+    printf("Forward searches in %.3f seconds, backward searches in %.3f seconds (%d threads).\n", t1 - t0, t2 - t1, nthreads);
+
+    free(table);
+    graph_close(&graph);
+    return 0;
+}
@@ -0,0 +1,396 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "graph.h"
+#include "heap.h"
+#include "ch.h"
+
+/*Contraction hierarchy preprocessing (see ch.h): reads map.bin and writes map.ch.
+
+The nodes are contracted in the order of a priority queue. The priority of a node is its edge
+difference (shortcuts it would add minus edges it would remove), plus the number of its neighbours
+already contracted and its level in the hierarchy, so that contraction spreads evenly over the
+map. Priorities are kept up to date lazily: a node taken from the queue is simulated again and
+goes back if it got worse than the next one.
+
+A shortcut u -> v -> x is only added when a witness search (a Dijkstra search from u that avoids
+v, limited in distance and size) finds no path to x as short as it. When the search gives up, the
+shortcut is added anyway, which is never wrong.
+
+The first simulation of every node only reads the graph and runs in parallel. Contraction changes
+the graph from one node to the next and is done by the calling thread alone, so the hierarchy does
+not depend on the number of threads.*/
+
+#define WITNESS_SETTLE_LIMIT    500     //Nodes a witness search may settle when contracting
+#define SIMULATE_SETTLE_LIMIT   100     //Same, when only estimating the priority
+
+
+void ExitError(const char *miss, int errcode) {
+    fprintf (stderr, "\nERROR: %s.\nStopping...\n\n", miss); exit(errcode);
+}
+
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+
+//Edge of the graph being contracted, stored at both ends (node is the other end).
+typedef struct {
+    NodeIndex node;
+    NodeIndex middle;
+    double w;
+} Arc;
+
+typedef struct {
+    Arc* a;
+    unsigned int n, cap;
+} ArcList;
+
+typedef struct {
+    unsigned long nnodes;
+    ArcList* out;               //Edges to nodes not contracted yet, then up edges once contracted
+    ArcList* in;                //Edges from nodes not contracted yet, then down edges once contracted
+    unsigned int* deleted;      //Contracted neighbours
+    unsigned int* level;
+    unsigned long nshortcuts;
+} Contraction;
+
+//Work arrays of a witness search, reset lazily with a generation counter.
+typedef struct {
+    double* dist;
+    unsigned int* gen;
+    unsigned int* target;       //== generation for the nodes the search still has to settle
+    unsigned int generation;
+    uint32_t* pos;
+    OpenHeap heap;
+} Witness;
+
+
+static void arc_push(ArcList* list, unsigned long node, unsigned long middle, double w) {
+    if (list->n == list->cap) {
+        list->cap = list->cap ? 2*list->cap : 4;
+        if ((list->a = (Arc*) realloc(list->a, list->cap*sizeof(Arc))) == NULL) ExitError("when allocating memory for the edges", 3);
+    }
+    list->a[list->n].node = node;
+    list->a[list->n].middle = middle;
+    list->a[list->n].w = w;
+    list->n += 1;
+}
+
+static Arc* arc_find(ArcList* list, unsigned long node) {
+    unsigned int i;
+    for (i = 0; i < list->n; i++) if (list->a[i].node == node) return &list->a[i];
+    return NULL;
+}
+
+static void arc_remove(ArcList* list, unsigned long node) {
+    Arc* arc = arc_find(list, node);
+    if (arc != NULL) *arc = list->a[--list->n];
+}
+
+//Adds the edge u -> x, or lowers the weight of the one already there.
+static void add_edge(Contraction* C, unsigned long u, unsigned long x, unsigned long middle, double w) {
+    Arc* arc = arc_find(&C->out[u], x);
+    if (arc == NULL) {
+        arc_push(&C->out[u], x, middle, w);
+        arc_push(&C->in[x], u, middle, w);
+        return;
+    }
+    if (arc->w <= w) return;
+    arc->w = w;
+    arc->middle = middle;
+    arc = arc_find(&C->in[x], u);
+    arc->w = w;
+    arc->middle = middle;
+}
+
+
+static void witness_init(Witness* W, unsigned long nnodes) {
+    if ((W->dist = (double*) malloc(nnodes*sizeof(double))) == NULL ||
+        (W->gen = (unsigned int*) calloc(nnodes, sizeof(unsigned int))) == NULL ||
+        (W->target = (unsigned int*) calloc(nnodes, sizeof(unsigned int))) == NULL ||
+        (W->pos = (uint32_t*) malloc(nnodes*sizeof(uint32_t))) == NULL)
+            ExitError("when allocating memory for the witness search", 3);
+    W->generation = 0;
+    heap_init(&W->heap, 1024, W->pos);
+}
+
+static void witness_free(Witness* W) {
+    heap_free(&W->heap);
+    free(W->dist);
+    free(W->gen);
+    free(W->target);
+    free(W->pos);
+}
+
+static inline double witness_dist(const Witness* W, unsigned long v) {
+    return (W->gen[v] == W->generation) ? W->dist[v] : INFINITY;
+}
+
+/*Dijkstra search from source that avoids skip. It stops when the successors of skip are all settled,
+past maxd or after limit settled nodes.*/
+static void witness_search(const Contraction* C, Witness* W, unsigned long source, unsigned long skip, double maxd, unsigned int limit) {
+    const ArcList* targets = &C->out[skip];
+    unsigned int i, left = 0;
+    W->generation += 1;
+    if (W->generation == 0) {
+        memset(W->gen, 0, C->nnodes*sizeof(unsigned int));
+        memset(W->target, 0, C->nnodes*sizeof(unsigned int));
+        W->generation = 1;
+    }
+    for (i = 0; i < targets->n; i++)
+        if (targets->a[i].node != source && W->target[targets->a[i].node] != W->generation) {
+            W->target[targets->a[i].node] = W->generation;
+            left += 1;
+        }
+    W->heap.size = 0;
+    W->gen[source] = W->generation;
+    W->dist[source] = 0;
+    heap_push(&W->heap, source, 0);
+    unsigned int settled = 0;
+    while (left > 0 && !heap_empty(&W->heap) && heap_min(&W->heap) <= maxd && settled < limit) {
+        unsigned long u = heap_pop(&W->heap);
+        settled += 1;
+        if (W->target[u] == W->generation) left -= 1;
+        const ArcList* out = &C->out[u];
+        for (i = 0; i < out->n; i++) {
+            unsigned long v = out->a[i].node;
+            if (v == skip) continue;
+            double d = W->dist[u] + out->a[i].w;
+            if (d >= witness_dist(W, v)) continue;
+            if (W->gen[v] != W->generation) {
+                W->gen[v] = W->generation;
+                heap_push(&W->heap, v, d);
+            }
+            else heap_decrease(&W->heap, v, d);
+            W->dist[v] = d;
+        }
+    }
+}
+
+/*Finds the shortcuts that contracting v needs and returns how many they are. With simulate false
+it also adds them to the graph.*/
+static unsigned long shortcuts(Contraction* C, Witness* W, unsigned long v, bool simulate) {
+    const ArcList* in = &C->in[v];
+    const ArcList* out = &C->out[v];
+    unsigned long count = 0;
+    unsigned int i, j;
+    for (i = 0; i < in->n; i++) {
+        unsigned long u = in->a[i].node;
+        double w1 = in->a[i].w, maxd = -1;
+        for (j = 0; j < out->n; j++) if (out->a[j].node != u && w1 + out->a[j].w > maxd) maxd = w1 + out->a[j].w;
+        if (maxd < 0) continue;
+        witness_search(C, W, u, v, maxd, simulate ? SIMULATE_SETTLE_LIMIT : WITNESS_SETTLE_LIMIT);
+        for (j = 0; j < out->n; j++) {
+            unsigned long x = out->a[j].node;
+            if (x == u || witness_dist(W, x) <= w1 + out->a[j].w) continue;
+            count += 1;
+            if (!simulate) add_edge(C, u, x, v, w1 + out->a[j].w);
+        }
+    }
+    return count;
+}
+
+static double priority(Contraction* C, Witness* W, unsigned long v) {
+    double added = (double) shortcuts(C, W, v, true);
+    double removed = (double) C->in[v].n + C->out[v].n;
+    return 2*(added - removed) + C->deleted[v] + C->level[v];
+}
+
+
+//Threads that compute the first priority of every node. The calling thread works as thread 0.
+typedef struct {
+    Contraction* C;
+    Witness* ws;
+    double* result;
+    unsigned long next;
+} SimPool;
+
+typedef struct {
+    SimPool* pool;
+    int id;
+} SimWorker;
+
+static void* sim_worker(void* arg) {
+    SimPool* pool = ((SimWorker*) arg)->pool;
+    Witness* W = &pool->ws[((SimWorker*) arg)->id];
+    unsigned long v;
+    while ((v = __atomic_fetch_add(&pool->next, 1, __ATOMIC_RELAXED)) < pool->C->nnodes) pool->result[v] = priority(pool->C, W, v);
+    return NULL;
+}
+
+
+//Appends a section at the next aligned offset and records it in the header.
+static void write_section(FILE* f, uint64_t* pos, CHHeader* hdr, int kind, const void* data, uint64_t size) {
+    static const char zeros[GRAPH_ALIGN];
+    uint64_t next = (*pos + GRAPH_ALIGN - 1) & ~(uint64_t)(GRAPH_ALIGN - 1);
+    if (fwrite(zeros, 1, next - *pos, f) != next - *pos || (size > 0 && fwrite(data, 1, size, f) != size))
+        ExitError("when writing to the hierarchy file", 10);
+    hdr->section[kind].offset = next;
+    hdr->section[kind].size = size;
+    *pos = next + size;
+}
+
+//Stores the edge lists of every node as one CSR array.
+static CHEdge* flatten(const ArcList* lists, unsigned long nnodes, uint64_t* offsets) {
+    unsigned long v, k = 0;
+    unsigned int i;
+    for (v = 0; v < nnodes; v++) {
+        offsets[v] = k;
+        k += lists[v].n;
+    }
+    offsets[nnodes] = k;
+    CHEdge* edges;
+    if ((edges = (CHEdge*) malloc((k+1)*sizeof(CHEdge))) == NULL) ExitError("when allocating memory for the hierarchy", 3);
+    for (v = 0, k = 0; v < nnodes; v++)
+        for (i = 0; i < lists[v].n; i++, k++) {
+            edges[k].node = lists[v].a[i].node;
+            edges[k].middle = lists[v].a[i].middle;
+            edges[k].weight = lists[v].a[i].w;
+        }
+    return edges;
+}
+
+
+int main (int argc, char *argv[]) {
+
+    //-t threads sets the number of worker threads (all the cores by default).
+    int nthreads = (int) sysconf(_SC_NPROCESSORS_ONLN);
+    int opt;
+    while ((opt = getopt(argc, argv, "t:")) != -1) {
+        if (opt == 't') nthreads = atoi(optarg);
+        else ExitError("usage: write_ch [-t threads] map.bin", 1);
+    }
+    if (optind >= argc) ExitError("usage: write_ch [-t threads] map.bin", 1);
+    if (nthreads < 1) nthreads = 1;
+    char* binfile = argv[optind];
+
+    Graph graph;
+    const char* err;
+    if ((err = graph_open(&graph, binfile)) != NULL) ExitError(err, 8);
+    unsigned long n = graph.nnodes, v;
+    double t0 = now();
+
+    Contraction C;
+    memset(&C, 0, sizeof(Contraction));
+    C.nnodes = n;
+    if ((C.out = (ArcList*) calloc(n, sizeof(ArcList))) == NULL || (C.in = (ArcList*) calloc(n, sizeof(ArcList))) == NULL ||
+        (C.deleted = (unsigned int*) calloc(n, sizeof(unsigned int))) == NULL ||
+        (C.level = (unsigned int*) calloc(n, sizeof(unsigned int))) == NULL)
+            ExitError("when allocating memory for the contraction", 3);
+    //Original edges, without loops and keeping the shortest of parallel edges:
+    NodeIndex* succ;
+    const NodeIndex* targets;
+    unsigned long k, nsucc, first;
+    if ((succ = (NodeIndex*) malloc((graph.max_degree + 1)*sizeof(NodeIndex))) == NULL) ExitError("when allocating memory for the contraction", 3);
+    for (v = 0; v < n; v++) {
+        nsucc = graph_adjacent(&graph, false, v, succ, &targets, &first);
+        for (k = 0; k < nsucc; k++)
+            if (targets[k] != v) add_edge(&C, v, targets[k], CH_NO_MIDDLE, graph_weight(&graph, first + k));
+    }
+    free(succ);
+
+    Witness* ws;
+    if ((ws = (Witness*) malloc(nthreads*sizeof(Witness))) == NULL) ExitError("when allocating memory for the witness search", 3);
+    int t;
+    for (t = 0; t < nthreads; t++) witness_init(&ws[t], n);
+    uint32_t* queue_pos;
+    NodeIndex* rank;
+    double* pri;
+    if ((pri = (double*) malloc((n+1)*sizeof(double))) == NULL || (rank = (NodeIndex*) malloc((n+1)*sizeof(NodeIndex))) == NULL ||
+        (queue_pos = (uint32_t*) malloc((n+1)*sizeof(uint32_t))) == NULL)
+            ExitError("when allocating memory for the contraction order", 3);
+
+    SimPool pool = {&C, ws, pri, 0};
+    pthread_t threads[nthreads];
+    SimWorker workers[nthreads];
+    for (t = 0; t < nthreads; t++) {
+        workers[t].pool = &pool;
+        workers[t].id = t;
+        if (t > 0 && pthread_create(&threads[t], NULL, sim_worker, &workers[t]) != 0) ExitError("when creating a worker thread", 14);
+    }
+    sim_worker(&workers[0]);
+    for (t = 1; t < nthreads; t++) pthread_join(threads[t], NULL);
+    OpenHeap queue;
+    heap_init(&queue, n, queue_pos);
+    for (v = 0; v < n; v++) heap_push(&queue, v, pri[v]);
+    double t1 = now();
+
+    unsigned long next_rank = 0, u;
+    unsigned int i;
+    while (!heap_empty(&queue)) {
+        v = heap_pop(&queue);
+        double p = priority(&C, &ws[0], v);
+        if (!heap_empty(&queue) && p > heap_min(&queue)) {
+            heap_push(&queue, v, p);
+            continue;
+        }
+        rank[v] = next_rank++;
+        C.nshortcuts += shortcuts(&C, &ws[0], v, false);
+        //The edges left at v are its up and down edges: take v out of its neighbours' lists.
+        for (i = 0; i < C.out[v].n; i++) {
+            u = C.out[v].a[i].node;
+            arc_remove(&C.in[u], v);
+            C.deleted[u] += 1;
+            if (C.level[u] < C.level[v] + 1) C.level[u] = C.level[v] + 1;
+        }
+        for (i = 0; i < C.in[v].n; i++) {
+            u = C.in[v].a[i].node;
+            arc_remove(&C.out[u], v);
+            if (arc_find(&C.out[v], u) != NULL) continue;
+            C.deleted[u] += 1;
+            if (C.level[u] < C.level[v] + 1) C.level[u] = C.level[v] + 1;
+        }
+    }
+    double t2 = now();
+
+    uint64_t* up_offsets;
+    uint64_t* down_offsets;
+    if ((up_offsets = (uint64_t*) malloc((n+1)*sizeof(uint64_t))) == NULL || (down_offsets = (uint64_t*) malloc((n+1)*sizeof(uint64_t))) == NULL)
+        ExitError("when allocating memory for the hierarchy", 3);
+    CHEdge* up = flatten(C.out, n, up_offsets);
+    CHEdge* down = flatten(C.in, n, down_offsets);
+
+    char name[4096];
+    graph_sidecar_path(binfile, ".ch", name, sizeof(name));
+    FILE* fout;
+    if ((fout = fopen(name, "wb")) == NULL) ExitError("the hierarchy file cannot be opened", 8);
+    CHHeader hdr;
+    memset(&hdr, 0, sizeof(CHHeader));
+    memcpy(hdr.magic, CH_MAGIC, sizeof(hdr.magic));
+    hdr.endian = GRAPH_ENDIAN_TAG;
+    hdr.version = CH_VERSION;
+    hdr.nnodes = n;
+    hdr.stamp = graph_stamp(&graph);
+    hdr.nup = up_offsets[n];
+    hdr.ndown = down_offsets[n];
+    uint64_t pos = sizeof(CHHeader);
+    if (fwrite(&hdr, sizeof(CHHeader), 1, fout) != 1) ExitError("when writing to the hierarchy file", 10);
+    write_section(fout, &pos, &hdr, CH_RANK, rank, n*sizeof(NodeIndex));
+    write_section(fout, &pos, &hdr, CH_UP_OFFSETS, up_offsets, (n+1)*sizeof(uint64_t));
+    write_section(fout, &pos, &hdr, CH_UP_EDGES, up, hdr.nup*sizeof(CHEdge));
+    write_section(fout, &pos, &hdr, CH_DOWN_OFFSETS, down_offsets, (n+1)*sizeof(uint64_t));
+    write_section(fout, &pos, &hdr, CH_DOWN_EDGES, down, hdr.ndown*sizeof(CHEdge));
+    if (fseek(fout, 0, SEEK_SET) != 0 || fwrite(&hdr, sizeof(CHHeader), 1, fout) != 1) ExitError("when writing to the hierarchy file", 10);
+    if (fclose(fout) != 0) ExitError("when closing the hierarchy file", 11);
+
+    printf("%lu nodes, %lu edges, %lu shortcuts: %lu up and %lu down edges in %s.\n", n, graph.nedges, C.nshortcuts,
+           (unsigned long)hdr.nup, (unsigned long)hdr.ndown, name);
+    printf("Priorities in %.3f seconds, contraction in %.3f seconds (%d threads).\n", t1 - t0, t2 - t1, nthreads);
+
+    for (v = 0; v < n; v++) { free(C.out[v].a); free(C.in[v].a); }
+    free(C.out); free(C.in); free(C.deleted); free(C.level);
+    for (t = 0; t < nthreads; t++) witness_free(&ws[t]);
+    free(ws); free(pri); free(rank); free(queue_pos); free(up_offsets); free(down_offsets); free(up); free(down);
+    heap_free(&queue);
+    graph_close(&graph);
+    return 0;
+}